@@ -0,0 +1,99 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <vector>
+#include "EnsembleClassifier.h"
+#include "FernKernel.h"
+#include "Params.h"
+#include "Utils.h"
+
+
+/**
+ * Throughput benchmark of the fern-code kernels (windows per second)
+ * on a random 1280x720 frame, compared with the per-window calcFern.
+ */
+int main()
+{
+    const int numRepetitions = 20;
+    tld::Params params;
+    tld::utils::Random rng(params.RNG_SEED);
+
+    cv::Mat frame(720, 1280, CV_8UC1);
+    cv::randu(frame, 0, 256);
+
+    // Windows of a single 64x64 scale with a 4 pixel step
+    tld::EnsembleClassifier ensemble(params.NUM_FERNS, params.NUM_BINARY_FEATURES, &rng);
+    const int scaleIndex = ensemble.addScale(cv::Size(64, 64));
+    std::vector<tld::Subwindow> windows;
+    for (int y = 0; y + 64 <= frame.rows; y += 4)
+    {
+        for (int x = 0; x + 64 <= frame.cols; x += 4)
+        {
+            windows.push_back({x, y, scaleIndex});
+        }
+    }
+    const int numWindows = static_cast<int>(windows.size());
+    const int numFerns = ensemble.numFerns;
+
+    std::vector<int> windowOffsets(numWindows);
+    for (int i = 0; i < numWindows; ++i)
+    {
+        windowOffsets[i] = windows[i].y * static_cast<int>(frame.step[0]) + windows[i].x;
+    }
+    std::vector<int> pairOffsets;
+    for (const cv::Point2i& p : ensemble.scaleOffsets[ensemble.scaleOffsetsIndex[scaleIndex]])
+    {
+        pairOffsets.push_back(p.y * static_cast<int>(frame.step[0]) + p.x);
+    }
+    const std::size_t dataSize = frame.dataend - frame.data;
+
+    auto report = [&](const std::string& name, double ticks)
+    {
+        double seconds = ticks / cv::getTickFrequency();
+        std::cout << name << ": " << numWindows * numRepetitions / seconds << " windows/s" << std::endl;
+    };
+
+    // Reference: per-window calcFern
+    std::vector<int> referenceCodes(numWindows * numFerns);
+    double timer = double(cv::getTickCount());
+    for (int r = 0; r < numRepetitions; ++r)
+    {
+        for (int i = 0; i < numWindows; ++i)
+        {
+            for (int k = 0; k < numFerns; ++k)
+            {
+                referenceCodes[i * numFerns + k] = ensemble.calcFern(frame, windows[i], k);
+            }
+        }
+    }
+    report("calcFern", cv::getTickCount() - timer);
+
+    // Batched kernels
+    std::vector<int> codes(numWindows * numFerns);
+    timer = double(cv::getTickCount());
+    for (int r = 0; r < numRepetitions; ++r)
+    {
+        tld::kernels::calcFernCodesScalar(frame.data, dataSize, windowOffsets.data(), numWindows,
+                                          pairOffsets.data(), numFerns, params.NUM_BINARY_FEATURES, codes.data());
+    }
+    report("scalar kernel", cv::getTickCount() - timer);
+    std::cout << " matches calcFern: " << (codes == referenceCodes) << std::endl;
+
+    if (tld::kernels::hasAVX2())
+    {
+        std::fill(codes.begin(), codes.end(), 0);
+        timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            tld::kernels::calcFernCodesAVX2(frame.data, dataSize, windowOffsets.data(), numWindows,
+                                            pairOffsets.data(), numFerns, params.NUM_BINARY_FEATURES, codes.data());
+        }
+        report("AVX2 kernel", cv::getTickCount() - timer);
+        std::cout << " matches calcFern: " << (codes == referenceCodes) << std::endl;
+    }
+    else
+    {
+        std::cout << "AVX2 kernel: not supported by the CPU" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "FernKernel.h"
+#include "NCCKernel.h"
+#include "Params.h"
+#include "TemplateStore.h"
+#include "Utils.h"
+
+
+/**
+ * Throughput benchmark of the NCC kernels (patch pairs per second) on the TEMPLATE_SIZE
+ * and NCC_PATCH_SIZE patches of a random 1280x720 frame, compared with cv::matchTemplate.
+ * Also times the template matching of a batch of candidates against a full object model
+ * (one dotF32 per pair and the batched TemplateStore::maxNCC), and the NCC check of
+ * the median-flow tracker (TOTAL_NUM_POINTS points per call) with getPatch and computeNCC
+ * per point and with computeNCCBatch.
+ */
+int main()
+{
+    const int numPairs = 20000;
+    const int numRepetitions = 10;
+    tld::Params params;
+    tld::utils::Random rng(params.RNG_SEED);
+
+    cv::Mat frame(720, 1280, CV_8UC1);
+    cv::randu(frame, 0, 256);
+    cv::GaussianBlur(frame, frame, cv::Size(5, 5), 1.5);  // correlated neighbours, like a real frame
+
+    for (const cv::Size& patchSize : {params.TEMPLATE_SIZE, params.NCC_PATCH_SIZE})
+    {
+        std::cout << patchSize.width << "x" << patchSize.height << " patches" << std::endl;
+
+        // Pairs of nearby patches (views into the frame)
+        std::vector<cv::Mat> patches1(numPairs);
+        std::vector<cv::Mat> patches2(numPairs);
+        for (int i = 0; i < numPairs; ++i)
+        {
+            const int x = rng.randi(0, frame.cols - patchSize.width - 2);
+            const int y = rng.randi(0, frame.rows - patchSize.height - 2);
+            patches1[i] = frame(cv::Rect(cv::Point(x, y), patchSize));
+            patches2[i] = frame(cv::Rect(cv::Point(x + rng.randi(0, 2), y + rng.randi(0, 2)), patchSize));
+        }
+
+        auto report = [&](const std::string& name, double ticks)
+        {
+            double seconds = ticks / cv::getTickFrequency();
+            std::cout << " " << name << ": " << numPairs * numRepetitions / seconds << " pairs/s" << std::endl;
+        };
+        auto maxDifference = [](const std::vector<float>& a, const std::vector<float>& b)
+        {
+            float difference = 0.0f;
+            for (std::size_t i = 0; i < a.size(); ++i)
+            {
+                difference = std::max(difference, std::abs(a[i] - b[i]));
+            }
+            return difference;
+        };
+
+        // Reference: cv::matchTemplate
+        std::vector<float> referenceNCC(numPairs);
+        double timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            for (int i = 0; i < numPairs; ++i)
+            {
+                cv::Mat ncc;
+                cv::matchTemplate(patches1[i], patches2[i], ncc, cv::TM_CCOEFF_NORMED);
+                referenceNCC[i] = ncc.at<float>(0, 0);
+            }
+        }
+        report("matchTemplate", cv::getTickCount() - timer);
+
+        std::vector<float> nccValues(numPairs);
+        timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            for (int i = 0; i < numPairs; ++i)
+            {
+                nccValues[i] = tld::kernels::nccU8Scalar(patches1[i].data, patches1[i].step[0],
+                                                         patches2[i].data, patches2[i].step[0],
+                                                         patchSize.width, patchSize.height);
+            }
+        }
+        report("scalar kernel", cv::getTickCount() - timer);
+        std::cout << "  max difference: " << maxDifference(nccValues, referenceNCC) << std::endl;
+
+        if (tld::kernels::hasAVX2())
+        {
+            timer = double(cv::getTickCount());
+            for (int r = 0; r < numRepetitions; ++r)
+            {
+                for (int i = 0; i < numPairs; ++i)
+                {
+                    nccValues[i] = tld::kernels::nccU8AVX2(patches1[i].data, patches1[i].step[0],
+                                                           patches2[i].data, patches2[i].step[0],
+                                                           patchSize.width, patchSize.height);
+                }
+            }
+            report("AVX2 kernel", cv::getTickCount() - timer);
+            std::cout << "  max difference: " << maxDifference(nccValues, referenceNCC) << std::endl;
+        }
+        else
+        {
+            std::cout << " AVX2 kernel: not supported by the CPU" << std::endl;
+        }
+
+        timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            for (int i = 0; i < numPairs; ++i)
+            {
+                nccValues[i] = tld::kernels::nccU8(patches1[i].data, patches1[i].step[0],
+                                                   patches2[i].data, patches2[i].step[0],
+                                                   patchSize.width, patchSize.height);
+            }
+        }
+        report("dispatched kernel", cv::getTickCount() - timer);
+
+        // Normalized vectors, as matched against the object model
+        const int length = patchSize.area();
+        cv::Mat vectors1(numPairs, length, CV_32F);
+        cv::Mat vectors2(numPairs, length, CV_32F);
+        for (int i = 0; i < numPairs; ++i)
+        {
+            tld::utils::normalizePatch(patches1[i], vectors1.ptr<float>(i));
+            tld::utils::normalizePatch(patches2[i], vectors2.ptr<float>(i));
+        }
+        timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            for (int i = 0; i < numPairs; ++i)
+            {
+                nccValues[i] = tld::kernels::dotF32(vectors1.ptr<float>(i), vectors2.ptr<float>(i), length);
+            }
+        }
+        report("dotF32 on normalized vectors", cv::getTickCount() - timer);
+        std::cout << "  max difference: " << maxDifference(nccValues, referenceNCC) << std::endl;
+    }
+
+    // Template matching of a batch of candidate patches against MAX_OBJ_MODEL_SIZE templates
+    const int numCandidates = 500;
+    const int numBatches = 20;
+    const cv::Size templateSize = params.TEMPLATE_SIZE;
+    tld::TemplateStore templates(templateSize, params.MAX_OBJ_MODEL_SIZE);
+    for (std::size_t j = 0; j < params.MAX_OBJ_MODEL_SIZE; ++j)
+    {
+        const int x = rng.randi(0, frame.cols - templateSize.width);
+        const int y = rng.randi(0, frame.rows - templateSize.height);
+        templates.push(frame(cv::Rect(cv::Point(x, y), templateSize)).clone());
+    }
+    cv::Mat candidateVectors(numCandidates, templateSize.area(), CV_32F);
+    for (int i = 0; i < numCandidates; ++i)
+    {
+        const int x = rng.randi(0, frame.cols - templateSize.width);
+        const int y = rng.randi(0, frame.rows - templateSize.height);
+        tld::utils::normalizePatch(frame(cv::Rect(cv::Point(x, y), templateSize)), candidateVectors.ptr<float>(i));
+    }
+    std::cout << numCandidates << " candidates against " << templates.size() << " templates" << std::endl;
+
+    auto reportBatch = [&](const std::string& name, double ticks)
+    {
+        double seconds = ticks / cv::getTickFrequency();
+        std::cout << " " << name << ": " << 1e3 * seconds / numBatches << " ms per batch" << std::endl;
+    };
+
+    const cv::Mat templateVectors = templates.vectors();
+    std::vector<float> pairMaxNCC(numCandidates);
+    double timer = double(cv::getTickCount());
+    for (int r = 0; r < numBatches; ++r)
+    {
+        for (int i = 0; i < numCandidates; ++i)
+        {
+            float best = -1.0f;
+            for (int j = 0; j < templateVectors.rows; ++j)
+            {
+                best = std::max(best, tld::kernels::dotF32(candidateVectors.ptr<float>(i), templateVectors.ptr<float>(j),
+                                                           templateVectors.cols));
+            }
+            pairMaxNCC[i] = best;
+        }
+    }
+    reportBatch("dotF32 per pair", cv::getTickCount() - timer);
+
+    std::vector<float> batchMaxNCC(numCandidates);
+    timer = double(cv::getTickCount());
+    for (int r = 0; r < numBatches; ++r)
+    {
+        templates.maxNCC(candidateVectors, batchMaxNCC.data());
+    }
+    reportBatch("TemplateStore::maxNCC (gemm)", cv::getTickCount() - timer);
+    float batchDifference = 0.0f;
+    for (int i = 0; i < numCandidates; ++i)
+    {
+        batchDifference = std::max(batchDifference, std::abs(batchMaxNCC[i] - pairMaxNCC[i]));
+    }
+    std::cout << "  max difference: " << batchDifference << std::endl;
+
+    // NCC check of the tracker: points of a grid and their slightly shifted positions, some near the border
+    const int numPoints = params.TOTAL_NUM_POINTS;
+    const int numCalls = 20000;
+    std::vector<cv::Point2f> points1(numPoints);
+    std::vector<cv::Point2f> points2(numPoints);
+    std::vector<unsigned char> status(numPoints, 1);
+    for (int i = 0; i < numPoints; ++i)
+    {
+        points1[i] = cv::Point2f(rng.randf(0.0f, float(frame.cols)), rng.randf(0.0f, float(frame.rows)));
+        points2[i] = points1[i] + cv::Point2f(rng.randf(-2.0f, 2.0f), rng.randf(-2.0f, 2.0f));
+    }
+
+    std::vector<float> referenceNCC;
+    timer = double(cv::getTickCount());
+    for (int r = 0; r < numCalls; ++r)
+    {
+        referenceNCC.clear();
+        for (int i = 0; i < numPoints; ++i)
+        {
+            cv::Mat patch1 = tld::utils::getPatch(frame, points1[i], params.NCC_PATCH_SIZE);
+            cv::Mat patch2 = tld::utils::getPatch(frame, points2[i], params.NCC_PATCH_SIZE);
+            referenceNCC.push_back(tld::utils::computeNCC(patch1, patch2));
+        }
+    }
+    double seconds = (cv::getTickCount() - timer) / cv::getTickFrequency();
+    std::cout << numPoints << " tracked points" << std::endl;
+    std::cout << " getPatch and computeNCC: " << 1e6 * seconds / numCalls << " us per call" << std::endl;
+
+    std::vector<float> nccValues(numPoints);
+    timer = double(cv::getTickCount());
+    for (int r = 0; r < numCalls; ++r)
+    {
+        tld::utils::computeNCCBatch(frame, points1.data(), frame, points2.data(), status.data(), numPoints,
+                                    params.NCC_PATCH_SIZE, nccValues.data());
+    }
+    seconds = (cv::getTickCount() - timer) / cv::getTickFrequency();
+    std::cout << " computeNCCBatch: " << 1e6 * seconds / numCalls << " us per call" << std::endl;
+    int numDifferent = 0;
+    for (int i = 0; i < numPoints; ++i)
+    {
+        numDifferent += (nccValues[i] != referenceNCC[i]);
+    }
+    std::cout << "  values different from computeNCC (border windows): " << numDifferent << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "Params.h"
+#include "Utils.h"
+
+
+/**
+ * Time and accuracy of the sampled scale estimation of the median-flow tracker compared
+ * with the exact median over all the point pairs, for a growing number of tracked points.
+ * The error of the sampled estimate is reported as its rank among all the pairwise ratios
+ * (0.5 is the exact median).
+ */
+int main()
+{
+    const int numRepetitions = 10;
+    tld::Params params;
+    tld::utils::Random rng(params.RNG_SEED);
+    const float rankTolerance = params.SCALE_MEDIAN_TOLERANCE > 0.0f ? params.SCALE_MEDIAN_TOLERANCE : 0.02f;
+    std::cout << "rank tolerance: " << rankTolerance
+              << ", sampled pairs: " << tld::utils::scaleSampleBudget(rankTolerance) << std::endl;
+
+    auto milliseconds = [&](double ticks)
+    {
+        return 1000.0 * ticks / cv::getTickFrequency() / numRepetitions;
+    };
+
+    for (int numPoints : {100, 400, 1600, 6400})
+    {
+        // Points in a 200x200 bbox scaled by 1.1 with noise in the tracked positions
+        std::vector<cv::Point2f> points1(numPoints);
+        std::vector<cv::Point2f> points2(numPoints);
+        for (int i = 0; i < numPoints; ++i)
+        {
+            points1[i] = cv::Point2f(rng.randf(0.0f, 200.0f), rng.randf(0.0f, 200.0f));
+            points2[i] = 1.1f * points1[i] + cv::Point2f(rng.randN(0.0f, 1.0f), rng.randN(0.0f, 1.0f));
+        }
+
+        float exact = 0.0f;
+        double timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            exact = tld::utils::medianScaleChange(points1, points2);
+        }
+        double exactTime = milliseconds(cv::getTickCount() - timer);
+
+        float sampled = 0.0f;
+        timer = double(cv::getTickCount());
+        for (int r = 0; r < numRepetitions; ++r)
+        {
+            sampled = tld::utils::medianScaleChange(points1, points2, rankTolerance, &rng);
+        }
+        double sampledTime = milliseconds(cv::getTickCount() - timer);
+
+        // Rank of the sampled estimate among all the pairwise ratios
+        std::size_t numBelow = 0;
+        std::size_t numRatios = 0;
+        for (int i = 0; i < numPoints; ++i)
+        {
+            for (int j = i + 1; j < numPoints; ++j)
+            {
+                cv::Point2f p1 = points1[i] - points1[j];
+                cv::Point2f p2 = points2[i] - points2[j];
+                float s1 = std::hypot(p1.x, p1.y);
+                float s2 = std::hypot(p2.x, p2.y);
+                if (s1 != 0 && s2 != 0)
+                {
+                    numBelow += (s2 / s1 < sampled);
+                    ++numRatios;
+                }
+            }
+        }
+
+        std::cout << numPoints << " points: exact " << exactTime << " ms (" << exact << "), "
+                  << "sampled " << sampledTime << " ms (" << sampled << ", rank "
+                  << double(numBelow) / std::max<std::size_t>(numRatios, 1) << ")" << std::endl;
+    }
+
+    return 0;
+}
@@ -1,11 +1,83 @@
+#include <algorithm>  // std::min, std::max
+#include <cmath>      // std::floor
+#include <thread>
+#include <utility>    // std::move
 #include "CascadeClassifier.h"
 #include "EnsembleClassifier.h"
+#include "VarianceKernel.h"
 #include "Utils.h"
 
 
+/**
+ * Fraction of the scanned (not skipped) windows rejected by the variance filter.
+ */
+float tld::DetectionStats::varianceRejectionRate() const
+{
+    if (this->numWindows == this->numSkipped)
+    {
+        return 0.0f;
+    }
+    return 1.0f - static_cast<float>(this->numVariancePassed) / (this->numWindows - this->numSkipped);
+}
+
+
+/**
+ * Average number of ferns evaluated per window that passed the variance filter.
+ */
+float tld::DetectionStats::averageFernsEvaluated() const
+{
+    if (this->numVariancePassed == 0)
+    {
+        return 0.0f;
+    }
+    return static_cast<float>(this->numFernsEvaluated) / this->numVariancePassed;
+}
+
+
+/**
+ * Fraction of the windows in the search region skipped because of their rejection history.
+ */
+float tld::DetectionStats::skippedRate() const
+{
+    if (this->numWindows == 0)
+    {
+        return 0.0f;
+    }
+    return static_cast<float>(this->numSkipped) / this->numWindows;
+}
+
+
+tld::DetectionStats& tld::DetectionStats::operator+=(const DetectionStats& other)
+{
+    this->numWindows += other.numWindows;
+    this->numSkipped += other.numSkipped;
+    this->numVariancePassed += other.numVariancePassed;
+    this->numFernsEvaluated += other.numFernsEvaluated;
+    this->numEnsemblePassed += other.numEnsemblePassed;
+    this->numTemplatePassed += other.numTemplatePassed;
+    this->smoothingTime += other.smoothingTime;
+    this->integralTime += other.integralTime;
+    this->scanningTime += other.scanningTime;
+    this->templateMatchingTime += other.templateMatchingTime;
+    return *this;
+}
+
+
+bool tld::DetectionResult::passedVariance(int i) const
+{
+    return (this->varianceMask[i >> 6] >> (i & 63)) & 1;
+}
+
+
+bool tld::DetectionResult::hasCodes(int i) const
+{
+    return (this->codesMask[i >> 6] >> (i & 63)) & 1;
+}
+
+
 tld::CascadeClassifier::CascadeClassifier(const cv::Mat &initialFrame,
                                           const BBox &initialBbox,
-                                          const ObjectModel &objectModel,
+                                          ObjectModel* objectModel,
                                           Params* params,
                                           tld::utils::Random* rng)
 {
@@ -13,120 +85,614 @@ tld::CascadeClassifier::CascadeClassifier(const cv::Mat &initialFrame,
     this->objectModel = objectModel;
     this->initialBbox = initialBbox;
 
-    cv::Mat iImage;
-    cv::Mat iImageSq;
-    tld::utils::computeIntegralImage2(initialFrame, iImage, iImageSq);
-    this->varMin = params->VARIANCE_FRACTION * this->patchVariance(iImage, iImageSq, initialBbox);
+    // Only the initial bbox is integrated
+    const cv::Rect initialRect = cv::Rect(initialBbox) & cv::Rect(cv::Point(0, 0), initialFrame.size());
+    tld::utils::IntegralImage integral;
+    tld::utils::computeIntegralImage2(initialFrame, initialRect, integral);
+    this->varMin = params->VARIANCE_FRACTION * this->patchVariance(integral, initialRect);
+
+    // Generate the grid of sliding windows, all of them sharing a single ensemble of ferns
+    this->grid = tld::ScanningGrid(initialFrame.size(), initialBbox, params);
+    this->ensemble = tld::EnsembleClassifier(params->NUM_FERNS, params->NUM_BINARY_FEATURES, rng);
+    this->addScales();
+
+    this->normalizer = tld::PatchNormalizer(params->TEMPLATE_SIZE, params->AREA_RESAMPLING);
+    this->setFrame(initialFrame);
+
+    std::cout << "Cascade detector initialized." << std::endl;
+}
+
+
+/**
+ * State of the detector in a model file, besides the grid and the ensemble.
+ */
+struct DetectorState
+{
+    float varMin;
+    float initialBbox[4];
+};
+
 
-    // Generate a pool of ensemble classifiers
-    const float stepX = params->WIDTH_FRACTION * initialBbox.width;
-    const float stepY = params->HEIGHT_FRACTION * initialBbox.height;
-    for (float s = params->MIN_SCALE; s <= params->MAX_SCALE; s += params->SCALE_STEP)
+/**
+ * Returns true if both grids have the same windows, scale by scale.
+ */
+static bool isSameGeometry(const tld::ScanningGrid& grid1, const tld::ScanningGrid& grid2)
+{
+    if (grid1.isPyramid != grid2.isPyramid || grid1.imageSize != grid2.imageSize
+        || grid1.scales.size() != grid2.scales.size())
+    {
+        return false;
+    }
+    for (std::size_t s = 0; s < grid1.scales.size(); ++s)
     {
-        float w = s * initialBbox.width;
-        float h = s * initialBbox.height;
-        if (w * h >= params->MIN_AREA)
+        const tld::GridScale& scale1 = grid1.scales[s];
+        const tld::GridScale& scale2 = grid2.scales[s];
+        if (scale1.windowSize != scale2.windowSize || scale1.strideX != scale2.strideX || scale1.strideY != scale2.strideY
+            || scale1.numCols != scale2.numCols || scale1.numRows != scale2.numRows || scale1.level != scale2.level)
         {
-            for (float y = 0.0f; (y + h) <= initialFrame.rows; y += stepY)
-            {
-                for (float x = 0.0f; (x + w) <= initialFrame.cols; x += stepX)
-                {
-                    BBox bbox(x, y, w, h);
-                    tld::EnsembleClassifier ensClf(params->NUM_FERNS, params->NUM_BINARY_FEATURES, bbox, rng);
-                    this->ensClfPool.push_back(ensClf);
-                }
-            }
+            return false;
         }
     }
+    return true;
+}
 
-    std::cout << "Cascade detector initialized." << std::endl;
+
+/**
+ * Constructor of CascadeClassifier from a model file (see save).
+ * The grid has to be generated for frames of the size of initialFrame, and the grid and the ferns
+ * have to be the ones the current parameters generate from the saved initial bbox
+ * (PYRAMID_SCANNING, the scales, the strides and MIN_AREA, NUM_FERNS and NUM_BINARY_FEATURES).
+ */
+tld::CascadeClassifier::CascadeClassifier(const ModelFile& file,
+                                          const cv::Mat &initialFrame,
+                                          ObjectModel* objectModel,
+                                          Params* params)
+{
+    this->params = params;
+    this->objectModel = objectModel;
+
+    const DetectorState state = file.value<DetectorState>(DETECTOR_STATE);
+    this->varMin = state.varMin;
+    this->initialBbox = BBox(state.initialBbox[0], state.initialBbox[1], state.initialBbox[2], state.initialBbox[3]);
+
+    this->grid = tld::ScanningGrid(file);
+    if (this->grid.frameSize != initialFrame.size())
+    {
+        CV_Error(cv::Error::StsError, "The grid of the model file was generated for another frame size");
+    }
+    if (!isSameGeometry(this->grid, tld::ScanningGrid(initialFrame.size(), this->initialBbox, params)))
+    {
+        CV_Error(cv::Error::StsError, "The grid of the model file does not match PYRAMID_SCANNING, MIN_SCALE, MAX_SCALE, "
+                                      "SCALE_STEP, WIDTH_FRACTION, HEIGHT_FRACTION and MIN_AREA");
+    }
+    this->ensemble = tld::EnsembleClassifier(file);
+    if (this->ensemble.numFerns != params->NUM_FERNS || this->ensemble.numBinaryFeatures != params->NUM_BINARY_FEATURES)
+    {
+        CV_Error(cv::Error::StsError, "The ferns of the model file do not match NUM_FERNS and NUM_BINARY_FEATURES");
+    }
+    this->addScales();
+
+    this->normalizer = tld::PatchNormalizer(params->TEMPLATE_SIZE, params->AREA_RESAMPLING);
+    this->setFrame(initialFrame);
+
+    std::cout << "Cascade detector loaded." << std::endl;
+}
+
+
+/**
+ * Adds the state of the detector, the grid and the ensemble to the model file.
+ */
+void tld::CascadeClassifier::save(ModelWriter& writer) const
+{
+    const DetectorState state = {this->varMin, {this->initialBbox.x, this->initialBbox.y,
+                                                this->initialBbox.width, this->initialBbox.height}};
+    writer.addSection(DETECTOR_STATE, state);
+    this->grid.save(writer);
+    this->ensemble.save(writer);
 }
 
 
 /**
- * Computes the variance of an image patch defined by the given bbox
- * using integral images integralImage and integralImage2.
+ * Adds the scales of the grid to the ensemble and computes their variance thresholds.
  */
-float tld::CascadeClassifier::patchVariance(const cv::Mat &integralImage,
-                                            const cv::Mat &integralImage2,
-                                            const BBox &bbox) const
+void tld::CascadeClassifier::addScales()
 {
-    float N = bbox.width * bbox.height;
-    float m = tld::utils::sumPatch(integralImage, bbox) / N;
-    float m2 = tld::utils::sumPatch(integralImage2, bbox) / N;
+    for (const tld::GridScale& scale : this->grid.scales)
+    {
+        this->ensemble.addScale(scale.windowSize);
 
-    return m2 - m * m;
+        // Integer threshold of the variance filter: area * sumOfSquares - sum^2 > varMin * area^2
+        double area = scale.windowSize.area();
+        this->varianceThresholds.push_back(static_cast<std::int64_t>(std::floor(this->varMin * area * area)));
+    }
 }
 
 
-float tld::CascadeClassifier::templateMatching(const cv::Mat& patch) const
+/**
+ * Sets the current frame, which the template matching of the bboxes refers to.
+ * Has to be called for every frame before detect and templateMatching.
+ */
+void tld::CascadeClassifier::setFrame(const cv::Mat &frame)
+{
+    this->normalizer.setFrame(frame);
+}
+
+
+/**
+ * Builds the image the fern codes are computed on: the scanned image (see ScanningGrid::buildImage)
+ * of the frame smoothed with FERN_SMOOTHING_SIGMA.
+ */
+void tld::CascadeClassifier::buildFernImage(const cv::Mat &frame, cv::Mat &smoothedImage) const
 {
-    cv::Mat patchResized;
-    cv::resize(patch, patchResized, params->TEMPLATE_SIZE, 0, 0, cv::INTER_CUBIC);
+    cv::Mat smoothedFrame;
+    if (params->FERN_SMOOTHING_SIGMA > 0.0f)
+    {
+        tld::utils::approxGaussianBlur(frame, smoothedFrame, params->FERN_SMOOTHING_SIGMA);
+    }
+    else
+    {
+        smoothedFrame = frame;
+    }
+    this->grid.buildImage(smoothedFrame, smoothedImage);
+}
+
+
+/**
+ * Computes the variance of an image patch defined by the given rect (in frame coordinates)
+ * using the integral images.
+ */
+float tld::CascadeClassifier::patchVariance(const tld::utils::IntegralImage &integral,
+                                            const cv::Rect &rect) const
+{
+    const cv::Rect integralRect = rect - integral.origin;
+    const double N = rect.area();
+    const double m = tld::utils::sumPatch(integral.sum, integral.cols, integralRect) / N;
+    const double m2 = tld::utils::sumPatch(integral.sqSum, integral.cols, integralRect) / N;
+
+    return static_cast<float>(m2 - m * m);
+}
+
+
+/**
+ * Relative similarity of the bbox of the current frame (see setFrame) to the object model.
+ */
+float tld::CascadeClassifier::templateMatching(const BBox& bbox)
+{
+    std::vector<float> similarities;
+    this->templateMatching(this->normalizer.vector(bbox), similarities);
+
+    return similarities[0];
+}
+
+
+/**
+ * Relative similarities of a batch of patches (rows of patchVectors, normalized with
+ * tld::utils::normalizePatch) to the object model, see TemplateStore::maxNCC.
+ * A missing template set counts as being at the maximal distance.
+ */
+void tld::CascadeClassifier::templateMatching(const cv::Mat& patchVectors, std::vector<float>& similarities) const
+{
+    CV_Assert(patchVectors.type() == CV_32F);
+    similarities.resize(patchVectors.rows);
+    if (patchVectors.rows == 0)
+    {
+        return;
+    }
+
+    // Largest NCCs of the patches to the positive and to the negative templates (-1 if there are none)
+    std::vector<float> posNCC(patchVectors.rows);
+    std::vector<float> negNCC(patchVectors.rows);
+    this->objectModel->positiveTemplates.maxNCC(patchVectors, posNCC.data());
+    this->objectModel->negativeTemplates.maxNCC(patchVectors, negNCC.data());
+
+    for (int i = 0; i < patchVectors.rows; ++i)
+    {
+        // Distance of the patch to the nearest template, 1 - 0.5 * (NCC + 1)
+        const float minPosDist = 0.5f * (1.0f - posNCC[i]);
+        const float minNegDist = 0.5f * (1.0f - negNCC[i]);
+        similarities[i] = minNegDist / (minNegDist + minPosDist);
+    }
+}
 
-    std::vector<float> posDistances;
-    for (const cv::Mat& posTempl : this->objectModel.positiveTemplates)
+
+/**
+ * Stage 1 of the cascade: evaluates the variance filter on the windows in the range [begin, end)
+ * whose centers lie in searchRegion (all of them if it is empty), one row of windows of a scale
+ * at a time, and sets the bits of the windows that pass in varianceMask.
+ * The integral images have to cover all these windows.
+ */
+void tld::CascadeClassifier::filterVarianceRange(const tld::utils::IntegralImage &integral,
+                                                 const cv::Rect &searchRegion,
+                                                 std::size_t begin,
+                                                 std::size_t end,
+                                                 std::uint64_t *varianceMask,
+                                                 DetectionStats &stats)
+{
+    for (std::size_t s = 0; s < this->grid.scales.size(); ++s)
     {
-        if (!posTempl.empty())
+        const tld::GridScale& scale = this->grid.scales[s];
+        const std::size_t scaleBegin = scale.firstIndex;
+        const std::size_t scaleEnd = scaleBegin + scale.numRows * scale.numCols;
+        if (scaleEnd <= begin || scaleBegin >= end)
         {
-            float posDist = 1.0f - 0.5f * (tld::utils::computeNCC(patchResized, posTempl) + 1.0f);
-            posDistances.push_back(posDist);
+            continue;
+        }
+
+        const cv::Rect range = this->grid.windowRange(static_cast<int>(s), searchRegion);
+        if (range.empty())
+        {
+            continue;
+        }
+
+        // Offsets of the top-right (B), bottom-left (C) and bottom-right (D) corners
+        // of a window relative to its top-left corner in the integral images
+        const int cornerB = scale.windowSize.width;
+        const int cornerC = scale.windowSize.height * integral.cols;
+        const int cornerD = cornerC + cornerB;
+
+        const int firstRow = std::max<int>(range.y, (std::max(begin, scaleBegin) - scaleBegin) / scale.numCols);
+        for (int row = firstRow; row < range.y + range.height; ++row)
+        {
+            const std::size_t rowBegin = scaleBegin + row * scale.numCols;
+            const std::size_t first = std::max(begin, rowBegin + range.x);
+            const std::size_t last = std::min(end, rowBegin + range.x + range.width);
+            if (rowBegin >= end)
+            {
+                break;
+            }
+            if (first >= last)
+            {
+                continue;
+            }
+
+            const int col = static_cast<int>(first - rowBegin);
+            const std::size_t corner = static_cast<std::size_t>(scale.level.y + row * scale.strideY - integral.origin.y) * integral.cols
+                                       + (scale.level.x + col * scale.strideX - integral.origin.x);
+            tld::kernels::varianceFilter(&integral.sum[corner], &integral.sqSum[corner],
+                                         static_cast<int>(last - first), scale.strideX,
+                                         cornerB, cornerC, cornerD,
+                                         scale.windowSize.area(), this->varianceThresholds[s],
+                                         varianceMask, first);
+            stats.numWindows += last - first;
+
+            if (params->TEMPORAL_SKIPPING)
+            {
+                this->applyRejectionHistory(first, last, varianceMask, stats);
+            }
         }
     }
-    float minPosDist = *std::min_element(posDistances.begin(), posDistances.end());
+}
+
 
-    std::vector<float> negDistances;
-    for (const cv::Mat& negTempl : this->objectModel.negativeTemplates)
+/**
+ * Skips the windows in the range [first, last) that were rejected in NEGATIVE_STREAK_FRAMES scans
+ * in a row (clears their bits in varianceMask), except every RECHECK_INTERVAL frames (staggered
+ * over the windows) and in the full sweeps. Updates the history of the windows rejected by the variance filter.
+ */
+void tld::CascadeClassifier::applyRejectionHistory(std::size_t first,
+                                                   std::size_t last,
+                                                   std::uint64_t *varianceMask,
+                                                   DetectionStats &stats)
+{
+    const int streakLimit = std::min(std::max(params->NEGATIVE_STREAK_FRAMES, 1), 255);
+    const std::size_t recheckInterval = std::max(params->RECHECK_INTERVAL, 1);
+    for (std::size_t i = first; i < last; ++i)
     {
-        if (!negTempl.empty())
+        std::uint8_t& streak = this->negativeStreaks[i];
+        const std::uint64_t bit = std::uint64_t(1) << (i & 63);
+        if (streak >= streakLimit && !this->isFullSweep && (i + this->frameIndex) % recheckInterval != 0)
         {
-            float negDist = 1.0f - 0.5f * (tld::utils::computeNCC(patchResized, negTempl) + 1.0f);
-            negDistances.push_back(negDist);
+            varianceMask[i >> 6] &= ~bit;
+            stats.numSkipped++;
         }
+        else if (!(varianceMask[i >> 6] & bit) && streak < 255)
+        {
+            streak++;
+        }
+    }
+}
+
+
+/**
+ * Stage 2 of the cascade: runs the ensemble classifier on the windows in the range [begin, end)
+ * that passed the variance filter, and appends the bboxes that pass to candidateBBoxes.
+ * The fern codes are computed in batches with the batched fern kernel, one fern at a time
+ * in the order of the schedule. With EARLY_REJECTION, a window is dropped from the batch
+ * as soon as its partial score plus the largest score of the remaining ferns cannot exceed the threshold.
+ * With TEMPORAL_SKIPPING, the rejection history of the windows is updated.
+ * If result is given, the per-window results are stored to it as well.
+ * The fern offsets are computed in the scratch of the calling thread.
+ */
+void tld::CascadeClassifier::detectRange(const cv::Mat &frame,
+                                         const std::uint64_t *varianceMask,
+                                         const FernSchedule &schedule,
+                                         std::size_t begin,
+                                         std::size_t end,
+                                         std::vector<BBox> &candidateBBoxes,
+                                         DetectionStats &stats,
+                                         DetectionResult *result,
+                                         FernScratch &scratch)
+{
+    if (begin >= end)
+    {
+        return;
     }
-    float minNegDist = *std::min_element(negDistances.begin(), negDistances.end());
 
-    float relativeDist = minNegDist / (minNegDist + minPosDist);
+    const int batchSize = 1024;
+    const int numFerns = this->ensemble.numFerns;
+    std::vector<tld::Subwindow> batch;
+    std::vector<int> batchIndices;
+    std::vector<int> codes(batchSize * numFerns);
+    std::vector<int> scores(batchSize);
+    std::vector<int> numEvaluated(batchSize);
+    std::vector<int> alive(batchSize);
+    std::vector<tld::Subwindow> aliveWindows(batchSize);
+    std::vector<int> fernCodes(batchSize);
+    batch.reserve(batchSize);
+    batchIndices.reserve(batchSize);
+
+    int s = this->grid.scaleIndex(static_cast<int>(begin));
+    std::size_t i = begin;
+    while (i < end)
+    {
+        // Collect the next batch of windows that passed the variance filter
+        batch.clear();
+        batchIndices.clear();
+        while (i < end && batch.size() < static_cast<std::size_t>(batchSize))
+        {
+            std::uint64_t word = varianceMask[i >> 6] >> (i & 63);
+            if (word == 0)
+            {
+                i = std::min(end, (i | 63) + 1);
+                continue;
+            }
+            i += __builtin_ctzll(word);
+            if (i >= end)
+            {
+                break;
+            }
+
+            while (s + 1 < static_cast<int>(this->grid.scales.size()) && static_cast<int>(i) >= this->grid.scales[s + 1].firstIndex)
+            {
+                ++s;
+            }
+            const tld::GridScale& scale = this->grid.scales[s];
+            const int offset = static_cast<int>(i) - scale.firstIndex;
+            batch.push_back(this->grid.window(s, offset / scale.numCols, offset % scale.numCols));
+            batchIndices.push_back(static_cast<int>(i));
+            ++i;
+        }
+        stats.numVariancePassed += batch.size();
+
+        // 2. Ensemble classification
+        int numAlive = static_cast<int>(batch.size());
+        for (int j = 0; j < numAlive; ++j)
+        {
+            alive[j] = j;
+            aliveWindows[j] = batch[j];
+            scores[j] = 0;
+        }
+        for (int step = 0; step < numFerns && numAlive > 0; ++step)
+        {
+            const int k = schedule.order[step];
+            this->ensemble.calcFerns(frame, aliveWindows.data(), numAlive, k, fernCodes.data(), &scratch);
+            stats.numFernsEvaluated += numAlive;
 
-    return relativeDist;
+            int numKept = 0;
+            for (int a = 0; a < numAlive; ++a)
+            {
+                const int j = alive[a];
+                codes[j * numFerns + k] = fernCodes[a];
+                scores[j] += this->ensemble.posterior(k, fernCodes[a]);
+                numEvaluated[j] = step + 1;
+                if (!params->EARLY_REJECTION || scores[j] + schedule.remainingMax[step] > this->ensemble.scoreThreshold)
+                {
+                    alive[numKept] = j;
+                    aliveWindows[numKept] = batch[j];
+                    numKept++;
+                }
+            }
+            numAlive = numKept;
+        }
+
+        for (std::size_t j = 0; j < batch.size(); ++j)
+        {
+            const bool complete = (numEvaluated[j] == numFerns);
+            if (result && complete)
+            {
+                const int index = batchIndices[j];
+                result->codesMask[index >> 6] |= std::uint64_t(1) << (index & 63);
+                result->confidences[index] = this->ensemble.scoreToConfidence(scores[j]);
+                std::copy(&codes[j * numFerns], &codes[(j + 1) * numFerns],
+                          &result->codes[index * numFerns]);
+            }
+
+            const bool passed = complete && scores[j] > this->ensemble.scoreThreshold;
+            if (passed)
+            {
+                stats.numEnsemblePassed++;
+                candidateBBoxes.push_back(this->grid.bbox(batch[j]));
+            }
+
+            if (params->TEMPORAL_SKIPPING)
+            {
+                std::uint8_t& streak = this->negativeStreaks[batchIndices[j]];
+                streak = passed ? 0 : std::min(streak + 1, 255);
+            }
+        }
+    }
 }
 
 
-std::vector<BBox> tld::CascadeClassifier::detect(const cv::Mat &frame) const
+/**
+ * Runs the cascade detector on the subwindows of the frame and returns the detections after NMS.
+ * The detections are in frame coordinates also in the PYRAMID_SCANNING mode.
+ * If searchRegion is not empty, only the subwindows whose centers lie in it are scanned and
+ * the integral images are computed only over the area covered by these subwindows.
+ * If result is given, it is filled with the variance status, the confidence and the fern codes
+ * of every window and with the counters of the cascade.
+ */
+std::vector<BBox> tld::CascadeClassifier::detect(const cv::Mat &frame,
+                                                 DetectionResult *result,
+                                                 const cv::Rect &searchRegion)
 {
+    DetectionStats stats;
+    auto elapsedTime = [](double& timer)
+    {
+        const double now = static_cast<double>(cv::getTickCount());
+        const double elapsed = 1000.0 * (now - timer) / cv::getTickFrequency();
+        timer = now;
+        return elapsed;
+    };
+    double timer = static_cast<double>(cv::getTickCount());
+
     // Preprocessing.
-    // cv::Mat frameBlured;
-    // cv::GaussianBlur(frame, frameBlured, cv::Size(0, 0), 3.0, 3.0, 0);
-    cv::Mat iImage;
-    cv::Mat iImageSq;
-    tld::utils::computeIntegralImage2(frame, iImage, iImageSq);
+    // The fern features are computed on the scanned image (the frame or the pyramid, see ScanningGrid)
+    // of a smoothed copy of the frame, which is shared with the learning through the result.
+    // The variance filter uses the scanned image of the frame itself, and the template matching the frame.
+    // The integral images of the frame are shared with the template matching (see PatchNormalizer).
+    cv::Mat localSmoothedImage;
+    cv::Mat& smoothedImage = result ? result->smoothedImage : localSmoothedImage;
+    this->buildFernImage(frame, smoothedImage);
+    stats.smoothingTime = elapsedTime(timer);
 
-    // Detection loop over all the subwindows.
-    std::vector<BBox> detectedBBoxes;
-    for (std::size_t i = 0; i < this->ensClfPool.size(); ++i)
+    tld::utils::IntegralImage localIntegral;
+    const tld::utils::IntegralImage* integralPtr = &localIntegral;
+    if (searchRegion.empty() && !this->grid.isPyramid)
     {
-        BBox bbox = this->ensClfPool[i].bbox;
-
-        // 1. Variance filtering
-        if (this->patchVariance(iImage, iImageSq, bbox) > this->varMin)
+        integralPtr = &this->normalizer.frameIntegral();
+    }
+    else
+    {
+        cv::Mat image;
+        this->grid.buildImage(frame, image);
+        if (searchRegion.empty())
+        {
+            tld::utils::computeIntegralImage2(image, localIntegral);
+        }
+        else
         {
-            // 2. Ensemble classification
-            // if (this->ensClfPool[i].classifyPatch(frameBlured) > 0.5f)
-            if (this->ensClfPool[i].classifyPatch(frame) > 0.5f)
+            // Area covered by all the windows whose centers lie in the search region
+            cv::Rect integralRegion;
+            for (std::size_t s = 0; s < this->grid.scales.size(); ++s)
             {
-                // 3. Template matching
-                cv::Mat patch = frame(bbox);
-                if (this->templateMatching(patch) > params->THETA_MINUS)
+                const tld::GridScale& scale = this->grid.scales[s];
+                const cv::Rect range = this->grid.windowRange(static_cast<int>(s), searchRegion);
+                if (!range.empty())
                 {
-                    detectedBBoxes.push_back(bbox);
+                    integralRegion |= cv::Rect(scale.level.x + range.x * scale.strideX, scale.level.y + range.y * scale.strideY,
+                                               (range.width - 1) * scale.strideX + scale.windowSize.width,
+                                               (range.height - 1) * scale.strideY + scale.windowSize.height);
                 }
-                
             }
+            tld::utils::computeIntegralImage2(image, integralRegion, localIntegral);
         }
     }
+    const tld::utils::IntegralImage& integral = *integralPtr;
+
+    stats.integralTime = elapsedTime(timer);
+
+    const std::size_t numWindows = this->grid.size();
+    const std::size_t numMaskWords = (numWindows + 63) / 64;
+    std::vector<std::uint64_t> localMask;
+    std::vector<std::uint64_t>& varianceMask = result ? result->varianceMask : localMask;
+    varianceMask.assign(numMaskWords, 0);
+    if (result)
+    {
+        result->codesMask.assign(numMaskWords, 0);
+        result->confidences.assign(numWindows, 0.0f);
+        result->codes.resize(numWindows * this->ensemble.numFerns);
+    }
+
+    const FernSchedule schedule = this->ensemble.schedule(params->EARLY_REJECTION && params->REORDER_FERNS);
+
+    // Rejection history: all the windows are scanned in the full sweeps.
+    // It is allocated at the first detection that uses it.
+    if (params->TEMPORAL_SKIPPING && this->negativeStreaks.empty())
+    {
+        this->negativeStreaks.assign(this->grid.size(), 0);
+    }
+    this->isFullSweep = (this->frameIndex % std::max(params->FULL_SWEEP_INTERVAL, 1) == 0);
+    this->frameIndex++;
+
+    // Detection loop over all the subwindows.
+    // The subwindows are split into contiguous ranges, one per worker thread, and the
+    // detections are merged in the order of the ranges, so that the result does not
+    // depend on the number of threads. The ranges are aligned to the words of the variance mask.
+    const std::size_t numThreads = std::min<std::size_t>(std::max(params->NUM_DETECTION_THREADS, 1),
+                                                         std::max<std::size_t>(numMaskWords, 1));
+    std::vector<std::vector<BBox>> threadBBoxes(numThreads);
+    std::vector<DetectionStats> threadStats(numThreads);
+    if (this->fernScratch.size() < numThreads)
+    {
+        this->fernScratch.resize(numThreads);
+    }
+    auto detectThread = [&](std::size_t t)
+    {
+        const std::size_t begin = std::min(numWindows, (t * numMaskWords / numThreads) * 64);
+        const std::size_t end = std::min(numWindows, ((t + 1) * numMaskWords / numThreads) * 64);
+
+        // 1. Variance filtering
+        this->filterVarianceRange(integral, searchRegion, begin, end, varianceMask.data(), threadStats[t]);
+
+        // 2. Ensemble classification
+        this->detectRange(smoothedImage, varianceMask.data(), schedule, begin, end, threadBBoxes[t], threadStats[t], result,
+                          this->fernScratch[t]);
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 1; t < numThreads; ++t)
+    {
+        workers.emplace_back(detectThread, t);
+    }
+    detectThread(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    std::vector<BBox> candidateBBoxes;
+    for (std::size_t t = 0; t < numThreads; ++t)
+    {
+        candidateBBoxes.insert(candidateBBoxes.end(), threadBBoxes[t].begin(), threadBBoxes[t].end());
+        stats += threadStats[t];
+    }
+    stats.scanningTime = elapsedTime(timer);
+
+    // The top-left part of the scanned image is the frame, so its integral images serve the area resampling
+    if (integralPtr == &localIntegral)
+    {
+        this->normalizer.setIntegral(std::move(localIntegral));
+    }
+
+    // 3. Template matching of all the windows that passed the ensemble classifier at once.
+    // The normalizer keeps the patches of the candidates, the negatives of the learning are among them.
+    cv::Mat patchVectors(static_cast<int>(candidateBBoxes.size()), params->TEMPLATE_SIZE.area(), CV_32F);
+    for (std::size_t i = 0; i < candidateBBoxes.size(); ++i)
+    {
+        this->normalizer.normalize(candidateBBoxes[i], patchVectors.ptr<float>(static_cast<int>(i)));
+    }
+    std::vector<float> similarities;
+    this->templateMatching(patchVectors, similarities);
+
+    std::vector<BBox> detectedBBoxes;
+    for (std::size_t i = 0; i < candidateBBoxes.size(); ++i)
+    {
+        if (similarities[i] > params->THETA_MINUS)
+        {
+            detectedBBoxes.push_back(candidateBBoxes[i]);
+        }
+    }
+    stats.numTemplatePassed = detectedBBoxes.size();
 
     // Apply non-maximal suppression on the set of detected bboxes
     std::vector<BBox> detectedBboxesFinal = tld::utils::NMS(detectedBBoxes, params->OVERLAP_THRESHOLD);
+    stats.templateMatchingTime = elapsedTime(timer);
+
+    if (result)
+    {
+        result->stats = stats;
+    }
 
     return detectedBboxesFinal;
 }
\ No newline at end of file
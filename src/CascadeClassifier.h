@@ -2,41 +2,143 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <cstdint>
 #include "EnsembleClassifier.h"
+#include "ModelFile.h"
 #include "ObjectModel.h"
+#include "PatchNormalizer.h"
+#include "ScanningGrid.h"
 #include "Params.h"
+#include "Utils.h"
 
 
 using BBox = cv::Rect2f;
 
 namespace tld
 {
+/**
+ * Per-frame counters of the detection cascade.
+ */
+struct DetectionStats
+{
+    std::size_t numWindows = 0;         // number of windows in the search region
+    std::size_t numSkipped = 0;         // windows skipped because of their rejection history (TEMPORAL_SKIPPING)
+    std::size_t numVariancePassed = 0;  // windows that passed the variance filter
+    std::size_t numFernsEvaluated = 0;  // ferns evaluated over all the windows that passed the variance filter
+    std::size_t numEnsemblePassed = 0;  // windows that passed the ensemble classifier
+    std::size_t numTemplatePassed = 0;  // windows that passed the template matching (before NMS)
+
+    // Times of the stages in milliseconds
+    double smoothingTime = 0.0;         // smoothing of the frame for the fern features (and its pyramid)
+    double integralTime = 0.0;          // integral images (and the pyramid of the frame)
+    double scanningTime = 0.0;          // variance filter and ensemble classifier (all threads)
+    double templateMatchingTime = 0.0;  // template matching and NMS
+
+    float varianceRejectionRate() const;
+
+    float averageFernsEvaluated() const;
+
+    float skippedRate() const;
+
+    DetectionStats& operator+=(const DetectionStats& other);
+};
+
+
+/**
+ * Per-frame results of the detector for every window of the grid (indexed by the flat index).
+ * The confidences and the fern codes are valid only for the windows that passed the variance filter
+ * and were not rejected early by the ensemble classifier (see hasCodes).
+ */
+struct DetectionResult
+{
+    std::vector<std::uint64_t> varianceMask;  // bit i is set if the window i passed the variance filter
+    std::vector<std::uint64_t> codesMask;     // bit i is set if all the ferns of the window i were evaluated
+    std::vector<float> confidences;           // ensemble confidences
+    std::vector<int> codes;                   // fern codes, numFerns consecutive values per window
+    cv::Mat smoothedImage;                    // image the fern codes are computed on (see ScanningGrid::buildImage)
+    DetectionStats stats;
+
+    bool passedVariance(int i) const;
+
+    bool hasCodes(int i) const;
+};
+
+
 class CascadeClassifier
 {
 private:
     BBox initialBbox;
     float varMin;
+    std::vector<std::int64_t> varianceThresholds;  // varMin * area^2 of each scale
+
+    // Rejection history (TEMPORAL_SKIPPING): number of consecutive scans (saturated at 255)
+    // in which each window was rejected by the variance filter or by the ensemble classifier
+    std::vector<std::uint8_t> negativeStreaks;
+    int frameIndex = 0;
+    bool isFullSweep = true;
+
+    // Scratch of the fern codes, one per detection thread, kept across frames
+    std::vector<tld::FernScratch> fernScratch;
+
+    void addScales();
+
+    void applyRejectionHistory(std::size_t first,
+                               std::size_t last,
+                               std::uint64_t *varianceMask,
+                               DetectionStats &stats);
+
+    void filterVarianceRange(const tld::utils::IntegralImage &integral,
+                             const cv::Rect &searchRegion,
+                             std::size_t begin,
+                             std::size_t end,
+                             std::uint64_t *varianceMask,
+                             DetectionStats &stats);
+
+    void detectRange(const cv::Mat &frame,
+                     const std::uint64_t *varianceMask,
+                     const FernSchedule &schedule,
+                     std::size_t begin,
+                     std::size_t end,
+                     std::vector<BBox> &candidateBBoxes,
+                     DetectionStats &stats,
+                     DetectionResult *result,
+                     FernScratch &scratch);
     
 public:
     Params* params;
-    ObjectModel objectModel;
-    std::vector<tld::EnsembleClassifier> ensClfPool;
+    ObjectModel* objectModel;          // shared with TLD, so the detector sees the learned templates
+    tld::ScanningGrid grid;            // sliding windows (subwindows)
+    tld::EnsembleClassifier ensemble;  // fern bank shared by all the subwindows
+    tld::PatchNormalizer normalizer;   // resampled and normalized bboxes of the current frame
 
 public:
     CascadeClassifier() = default;
     CascadeClassifier(const cv::Mat &initialFrame,
                       const BBox &initialBbox,
-                      const ObjectModel& objectModel,
+                      ObjectModel* objectModel,
                       Params* params,
                       tld::utils::Random* rng);
+    CascadeClassifier(const ModelFile& file,
+                      const cv::Mat &initialFrame,
+                      ObjectModel* objectModel,
+                      Params* params);
+
+    void save(ModelWriter& writer) const;
+
+    void setFrame(const cv::Mat &frame);
+
+    void buildFernImage(const cv::Mat &frame, cv::Mat &smoothedImage) const;
+
+    std::vector<BBox> detect(const cv::Mat &frame,
+                             DetectionResult *result = nullptr,
+                             const cv::Rect &searchRegion = cv::Rect());
 
-    std::vector<BBox> detect(const cv::Mat &frame) const;
+    float patchVariance(const tld::utils::IntegralImage &integral,
+                        const cv::Rect &rect) const;
 
-    float patchVariance(const cv::Mat& integralImage,
-                        const cv::Mat& integralImage2,
-                        const BBox& bbox) const;
+    float templateMatching(const BBox& bbox);
 
-    float templateMatching(const cv::Mat& patch) const;
+    void templateMatching(const cv::Mat& patchVectors, std::vector<float>& similarities) const;
 
 };
 
@@ -1,51 +1,153 @@
+#include <algorithm>  // std::find, std::max_element, std::stable_sort
+#include <cstdint>
+#include <numeric>    // std::iota
+#include <limits>
 #include "EnsembleClassifier.h"
+#include "FernKernel.h"
 #include "Utils.h"
 
 
 /**
-* Constructor of Fern.
+* Constructor of EnsembleClassifier.
+* Generates the random pixel pairs of all the ferns, normalized to the window size.
 */
-tld::Fern::Fern(int numBinaryFeatures, const BBox& bbox, tld::utils::Random* rng)
+tld::EnsembleClassifier::EnsembleClassifier(int numFerns, int numBinaryFeatures, tld::utils::Random* rng)
 {
-    //CV_Assert(numBinaryFeatures > 0  && !bbox.empty());
+    CV_Assert(numFerns > 0 && numBinaryFeatures > 0);
 
+    this->numFerns = numFerns;
     this->numBinaryFeatures = numBinaryFeatures;
-    this->pixelPairs = std::vector<cv::Point2i>(2 * numBinaryFeatures);
+    this->posteriorSize = (1 << numBinaryFeatures);  // 2^numBinaryFeatures
 
-    int posteriorSize = (std::uint64_t(1) << numBinaryFeatures);  // 2^numBinaryFeatures
-    this->numPos = std::vector<float>(posteriorSize, 0.0f);
-    this->numNeg = std::vector<float>(posteriorSize, 0.0f);
+    this->numPos = cv::Mat::zeros(numFerns, this->posteriorSize, CV_16UC1);
+    this->numNeg = cv::Mat::zeros(numFerns, this->posteriorSize, CV_16UC1);
+    this->posteriors = cv::Mat::zeros(numFerns, this->posteriorSize, CV_16UC1);
+    this->maxPosteriors = std::vector<int>(numFerns, 0);
+    this->scoreThreshold = numFerns * POSTERIOR_ONE / 2;
 
     // Generate random pixel-pairs locations
-    for (int i = 0; i < 2 * numBinaryFeatures; i += 2)
+    this->pixelPairs = std::vector<cv::Point2f>(2 * numFerns * numBinaryFeatures);
+    for (cv::Point2f& p : this->pixelPairs)
+    {
+        p.x = rng->randf(0.0f, 1.0f);
+        p.y = rng->randf(0.0f, 1.0f);
+    }
+}
+
+
+/**
+* Sizes of the ensemble in a model file.
+*/
+struct EnsembleInfo
+{
+    std::int32_t numFerns;
+    std::int32_t numBinaryFeatures;
+};
+
+
+/**
+* Constructor of EnsembleClassifier from a model file (see save).
+* The posterior counters and the posteriors are used in place in the mapped file,
+* the scales have to be added again.
+*/
+tld::EnsembleClassifier::EnsembleClassifier(const ModelFile& file)
+{
+    const EnsembleInfo info = file.value<EnsembleInfo>(ENSEMBLE_INFO);
+    CV_Assert(info.numFerns > 0 && info.numBinaryFeatures > 0 && info.numBinaryFeatures < 16);
+
+    this->numFerns = info.numFerns;
+    this->numBinaryFeatures = info.numBinaryFeatures;
+    this->posteriorSize = (1 << numBinaryFeatures);
+
+    const std::size_t numEntries = static_cast<std::size_t>(this->numFerns) * this->posteriorSize;
+    this->numPos = cv::Mat(this->numFerns, this->posteriorSize, CV_16UC1, file.section<ushort>(ENSEMBLE_NUM_POS, numEntries));
+    this->numNeg = cv::Mat(this->numFerns, this->posteriorSize, CV_16UC1, file.section<ushort>(ENSEMBLE_NUM_NEG, numEntries));
+    this->posteriors = cv::Mat(this->numFerns, this->posteriorSize, CV_16UC1, file.section<ushort>(ENSEMBLE_POSTERIORS, numEntries));
+    this->maxPosteriors = std::vector<int>(this->numFerns, 0);
+    for (int k = 0; k < this->numFerns; ++k)
+    {
+        const ushort* const posteriorRow = this->posteriors.ptr<ushort>(k);
+        this->maxPosteriors[k] = *std::max_element(posteriorRow, posteriorRow + this->posteriorSize);
+    }
+    this->scoreThreshold = numFerns * POSTERIOR_ONE / 2;
+
+    const std::size_t numPoints = 2 * static_cast<std::size_t>(this->numFerns) * this->numBinaryFeatures;
+    const cv::Point2f* const pixelPairsData = file.section<cv::Point2f>(ENSEMBLE_PIXEL_PAIRS, numPoints);
+    this->pixelPairs = std::vector<cv::Point2f>(pixelPairsData, pixelPairsData + numPoints);
+
+    // The pixels are relative to the window, other values would make the features read outside of it
+    // (the negated comparisons also reject NaNs)
+    for (const cv::Point2f& p : this->pixelPairs)
     {
-        int x1 = std::floor(rng->randi(bbox.x, bbox.x + bbox.width));
-        int y1 = std::floor(rng->randi(bbox.y, bbox.y + bbox.height));
-        int x2 = std::floor(rng->randi(bbox.x, bbox.x + bbox.width));
-        int y2 = std::floor(rng->randi(bbox.y, bbox.y + bbox.height));
-        cv::Point2i p1(x1, y1);
-        cv::Point2i p2(x2, y2);
-
-        this->pixelPairs[i] = p1;
-        this->pixelPairs[i + 1] = p2;
+        if (!(p.x >= 0.0f && p.x <= 1.0f && p.y >= 0.0f && p.y <= 1.0f))
+        {
+            CV_Error(cv::Error::StsError, "The pixel pairs of the model file are not within [0, 1]");
+        }
     }
 }
 
 
 /**
-* Calculates the fern value for a given frame.
+* Adds the pixel pairs, the posterior counters and the posteriors to the model file.
+*/
+void tld::EnsembleClassifier::save(ModelWriter& writer) const
+{
+    CV_Assert(this->numPos.isContinuous() && this->numNeg.isContinuous() && this->posteriors.isContinuous());
+
+    const EnsembleInfo info = {this->numFerns, this->numBinaryFeatures};
+    const std::size_t countersSize = this->numPos.total() * this->numPos.elemSize();
+    writer.addSection(ENSEMBLE_INFO, info);
+    writer.addSection(ENSEMBLE_PIXEL_PAIRS, this->pixelPairs.data(), this->pixelPairs.size() * sizeof(cv::Point2f));
+    writer.addSection(ENSEMBLE_NUM_POS, this->numPos.data, countersSize);
+    writer.addSection(ENSEMBLE_NUM_NEG, this->numNeg.data, countersSize);
+    writer.addSection(ENSEMBLE_POSTERIORS, this->posteriors.data, countersSize);
+}
+
+
+/**
+* Adds a scale with the given window size. The pixel-pair offsets are computed and appended
+* to scaleOffsets only if no previous scale has the same window size. Returns the index of the new scale.
 */
-int tld::Fern::calcFern(const cv::Mat& frame, const BBox& bbox) const
+int tld::EnsembleClassifier::addScale(const cv::Size& windowSize)
 {
-    CV_Assert(tld::utils::bboxWithinImage(bbox, frame));
+    CV_Assert(!windowSize.empty());
+
+    auto it = std::find(this->offsetsWindowSizes.begin(), this->offsetsWindowSizes.end(), windowSize);
+    if (it != this->offsetsWindowSizes.end())
+    {
+        this->scaleOffsetsIndex.push_back(static_cast<int>(it - this->offsetsWindowSizes.begin()));
+        return static_cast<int>(this->scaleOffsetsIndex.size()) - 1;
+    }
+
+    std::vector<cv::Point2i> offsets(this->pixelPairs.size());
+    for (std::size_t i = 0; i < this->pixelPairs.size(); ++i)
+    {
+        offsets[i].x = std::min(static_cast<int>(this->pixelPairs[i].x * windowSize.width), windowSize.width - 1);
+        offsets[i].y = std::min(static_cast<int>(this->pixelPairs[i].y * windowSize.height), windowSize.height - 1);
+    }
+
+    this->scaleOffsets.push_back(offsets);
+    this->offsetsWindowSizes.push_back(windowSize);
+    this->scaleOffsetsIndex.push_back(static_cast<int>(this->scaleOffsets.size()) - 1);
+
+    return static_cast<int>(this->scaleOffsetsIndex.size()) - 1;
+}
+
+
+/**
+* Calculates the value of the k-th fern for the given window of the frame.
+*/
+int tld::EnsembleClassifier::calcFern(const cv::Mat& frame, const Subwindow& window, int k) const
+{
+    const cv::Point2i* offsets = &this->scaleOffsets[this->scaleOffsetsIndex[window.scaleIndex]][2 * k * numBinaryFeatures];
 
     int F = 0;
     for (int i = 0; i < 2 * numBinaryFeatures; i += 2)
     {
-        cv::Point2i p1 = this->pixelPairs[i];
-        cv::Point2i p2 = this->pixelPairs[i + 1];
-        uchar pix1 = frame.at<uchar>(p1.y, p1.x);
-        uchar pix2 = frame.at<uchar>(p2.y, p2.x);
+        const cv::Point2i& p1 = offsets[i];
+        const cv::Point2i& p2 = offsets[i + 1];
+        uchar pix1 = frame.ptr<uchar>(window.y + p1.y)[window.x + p1.x];
+        uchar pix2 = frame.ptr<uchar>(window.y + p2.y)[window.x + p2.x];
         F = (F << 1) | (pix1 > pix2);
     }
 
@@ -54,42 +156,205 @@ int tld::Fern::calcFern(const cv::Mat& frame, const BBox& bbox) const
 
 
 /**
-* Constructor of EnsembleClassifier.
+* Calculates the codes of all the ferns for count windows of the frame
+* and stores them to codes[i * numFerns + k] using the batched fern kernels.
+* The offsets are computed in scratch if given (see FernScratch), otherwise in local buffers.
 */
-tld::EnsembleClassifier::EnsembleClassifier(int numFerns, int numBinaryFeatures, BBox bbox, tld::utils::Random* rng)
+void tld::EnsembleClassifier::calcFerns(const cv::Mat& frame, const Subwindow* windows, int count, int* codes,
+                                        FernScratch* scratch) const
 {
+    this->calcFerns(frame, windows, count, 0, this->numFerns, codes, scratch);
+}
 
-    CV_Assert(numFerns > 0 && numBinaryFeatures > 0 && !bbox.empty());
 
-    this->numFerns = numFerns;
-    this->numBinaryFeatures = numBinaryFeatures;
-    this->bbox = bbox;
+/**
+* Calculates the code of the k-th fern for count windows of the frame and stores them to codes[i].
+*/
+void tld::EnsembleClassifier::calcFerns(const cv::Mat& frame, const Subwindow* windows, int count, int k, int* codes,
+                                        FernScratch* scratch) const
+{
+    this->calcFerns(frame, windows, count, k, 1, codes, scratch);
+}
+
+
+/**
+* Calculates the codes of the ferns firstFern, ..., firstFern + numFernsToCompute - 1 for count windows
+* of the frame and stores them to codes[i * numFernsToCompute + (k - firstFern)].
+*/
+void tld::EnsembleClassifier::calcFerns(const cv::Mat& frame, const Subwindow* windows, int count,
+                                        int firstFern, int numFernsToCompute, int* codes, FernScratch* scratch) const
+{
+    CV_Assert(frame.type() == CV_8UC1);
+    CV_Assert(frame.step[0] * frame.rows < static_cast<std::size_t>(std::numeric_limits<int>::max()));
+
+    const std::size_t dataSize = frame.dataend - frame.data;
+    const int step = static_cast<int>(frame.step[0]);
+    FernScratch localScratch;
+    FernScratch& buffers = scratch ? *scratch : localScratch;
+    buffers.pairOffsets.resize(this->pixelPairs.size());
+    if (buffers.windowOffsets.size() < static_cast<std::size_t>(count))
+    {
+        buffers.windowOffsets.resize(count);
+    }
+    int* const pairOffsets = buffers.pairOffsets.data();
+    int* const windowOffsets = buffers.windowOffsets.data();
+
+    // Process the runs of consecutive windows sharing the pixel-pair offsets
+    int begin = 0;
+    while (begin < count)
+    {
+        const int offsetsIndex = this->scaleOffsetsIndex[windows[begin].scaleIndex];
+        int end = begin;
+        while (end < count && this->scaleOffsetsIndex[windows[end].scaleIndex] == offsetsIndex)
+        {
+            windowOffsets[end - begin] = windows[end].y * step + windows[end].x;
+            ++end;
+        }
+
+        const cv::Point2i* offsets = &this->scaleOffsets[offsetsIndex][2 * firstFern * numBinaryFeatures];
+        for (int i = 0; i < 2 * numFernsToCompute * numBinaryFeatures; ++i)
+        {
+            pairOffsets[i] = offsets[i].y * step + offsets[i].x;
+        }
+
+        tld::kernels::calcFernCodes(frame.data, dataSize, windowOffsets, end - begin,
+                                    pairOffsets, numFernsToCompute, numBinaryFeatures,
+                                    codes + begin * numFernsToCompute);
+        begin = end;
+    }
+}
+
 
+/**
+* Returns the posterior probability of the given window of the frame being positive.
+*/
+float tld::EnsembleClassifier::classifyPatch(const cv::Mat& frame, const Subwindow& window) const
+{
+    int score = 0;
     for (int k = 0; k < this->numFerns; ++k)
     {
-        this->ferns.emplace_back(Fern(numBinaryFeatures, bbox, rng));
+        score += this->posteriors.ptr<ushort>(k)[this->calcFern(frame, window, k)];
     }
+
+    return this->scoreToConfidence(score);
+}
+
+
+/**
+* Returns the posterior probability of a window being positive given its fern codes.
+*/
+float tld::EnsembleClassifier::classifyCodes(const int* codes) const
+{
+    return this->scoreToConfidence(this->scoreCodes(codes));
 }
 
 
 /**
-* Returns the posterior probability of the given patch (frame(this->bbox)) being positive.
+* Returns the ensemble score of a window given its fern codes, i.e. the sum of the quantized
+* posteriors of all the ferns. The window is positive if the score exceeds scoreThreshold.
 */
-float tld::EnsembleClassifier::classifyPatch(const cv::Mat& frame) const
+int tld::EnsembleClassifier::scoreCodes(const int* codes) const
 {
-    // Average posterior probability from all the ferns.
-    float avgP = 0.0f;
+    int score = 0;
     for (int k = 0; k < this->numFerns; ++k)
     {
-        int Fk = this->ferns[k].calcFern(frame, this->bbox);
-        float numPk = this->ferns[k].numPos[Fk];
-        float numNk = this->ferns[k].numNeg[Fk];
-        if ((numPk + numNk) != 0)
+        score += this->posteriors.ptr<ushort>(k)[codes[k]];
+    }
+
+    return score;
+}
+
+
+/**
+* Returns the quantized posterior of the k-th fern for the fern value Fk.
+*/
+int tld::EnsembleClassifier::posterior(int k, int Fk) const
+{
+    return this->posteriors.ptr<ushort>(k)[Fk];
+}
+
+
+/**
+* Returns the order in which the ferns are evaluated and the corresponding early-rejection bounds.
+* If reorder is set, the ferns that lower the bound the most on the negative examples come first,
+* i.e. the ferns with the largest difference between their largest and their average posterior
+* over the negative examples. Otherwise the ferns are evaluated in their natural order.
+*/
+tld::FernSchedule tld::EnsembleClassifier::schedule(bool reorder) const
+{
+    FernSchedule schedule;
+    schedule.order = std::vector<int>(this->numFerns);
+    std::iota(schedule.order.begin(), schedule.order.end(), 0);
+
+    if (reorder)
+    {
+        std::vector<double> discrimination(this->numFerns, 0.0);
+        for (int k = 0; k < this->numFerns; ++k)
         {
-            avgP += numPk / (numPk + numNk);
+            double negSum = 0.0;
+            double negPosteriorSum = 0.0;
+            for (int Fk = 0; Fk < this->posteriorSize; ++Fk)
+            {
+                const double numNk = this->numNeg.ptr<ushort>(k)[Fk];
+                negSum += numNk;
+                negPosteriorSum += numNk * this->posterior(k, Fk);
+            }
+            const double avgNegPosterior = (negSum > 0.0) ? negPosteriorSum / negSum : 0.0;
+            discrimination[k] = this->maxPosteriors[k] - avgNegPosterior;
         }
+        std::stable_sort(schedule.order.begin(), schedule.order.end(),
+                         [&discrimination](int a, int b) { return discrimination[a] > discrimination[b]; });
     }
-    avgP /= this->numFerns;
 
-    return avgP;
-}
\ No newline at end of file
+    schedule.remainingMax = std::vector<int>(this->numFerns, 0);
+    for (int i = this->numFerns - 2; i >= 0; --i)
+    {
+        schedule.remainingMax[i] = schedule.remainingMax[i + 1] + this->maxPosteriors[schedule.order[i + 1]];
+    }
+
+    return schedule;
+}
+
+
+/**
+* Converts the ensemble score to the average posterior probability in [0, 1].
+*/
+float tld::EnsembleClassifier::scoreToConfidence(int score) const
+{
+    return static_cast<float>(score) / (this->numFerns * POSTERIOR_ONE);
+}
+
+
+/**
+* Updates the posterior counters of all the ferns with a window, given by its fern codes,
+* as a positive or negative example.
+*/
+void tld::EnsembleClassifier::update(const int* codes, bool positive)
+{
+    cv::Mat& counters = positive ? this->numPos : this->numNeg;
+    for (int k = 0; k < this->numFerns; ++k)
+    {
+        ushort& counter = counters.ptr<ushort>(k)[codes[k]];
+        if (counter == std::numeric_limits<ushort>::max())
+        {
+            // Halve both the counters on saturation, which keeps the posterior unchanged.
+            this->numPos.ptr<ushort>(k)[codes[k]] /= 2;
+            this->numNeg.ptr<ushort>(k)[codes[k]] /= 2;
+        }
+        counter += 1;
+        this->updatePosterior(k, codes[k]);
+    }
+}
+
+
+/**
+* Recomputes the quantized posterior of the k-th fern for the fern value Fk.
+*/
+void tld::EnsembleClassifier::updatePosterior(int k, int Fk)
+{
+    const std::int64_t numPk = this->numPos.ptr<ushort>(k)[Fk];
+    const std::int64_t numNk = this->numNeg.ptr<ushort>(k)[Fk];
+    ushort* posteriorRow = this->posteriors.ptr<ushort>(k);
+    posteriorRow[Fk] = static_cast<ushort>((numPk * POSTERIOR_ONE + (numPk + numNk) / 2) / (numPk + numNk));
+    this->maxPosteriors[k] = *std::max_element(posteriorRow, posteriorRow + this->posteriorSize);
+}
@@ -2,7 +2,8 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
-#include <utility>  // std::pair
+#include "ModelFile.h"
+#include "ScanningGrid.h"
 #include "Utils.h"
 
 
@@ -10,30 +11,101 @@ using BBox = cv::Rect2f;
 
 namespace tld
 {
-class Fern
+/**
+ * Order in which the ferns are evaluated, together with the bounds used for the early rejection:
+ * remainingMax[i] is the largest score the ferns order[i + 1], ..., order[numFerns - 1] can still add.
+ */
+struct FernSchedule
 {
-public:
-    int numBinaryFeatures;
-    std::vector<cv::Point2i> pixelPairs;
-    std::vector<float> numPos;
-    std::vector<float> numNeg;
-    
-public:
-    Fern(int numBinaryFeatures, const BBox& bbox, tld::utils::Random* rng);
-    int calcFern(const cv::Mat& frame, const BBox& bbox) const;
+    std::vector<int> order;
+    std::vector<int> remainingMax;
 };
 
 
+/**
+ * Scratch buffers of calcFerns (integer offsets of the pixel pairs and of the windows in the frame).
+ * Each thread keeps its own one across calls, so that the batches allocate nothing once they have grown.
+ */
+struct FernScratch
+{
+    std::vector<int> pairOffsets;
+    std::vector<int> windowOffsets;
+};
+
+
+/**
+ * Ensemble of ferns shared by all the subwindows.
+ * The pixel pairs are stored relative to the window and normalized to [0, 1),
+ * and are converted to integer offsets once per window size.
+ */
 class EnsembleClassifier
 {
 public:
-    int numFerns;       // number of ferns in the ensemble
+    int numFerns;           // number of ferns in the ensemble
     int numBinaryFeatures;  // number of binary features (pixel pairs) per fern
-    BBox bbox;
-    std::vector<Fern> ferns;
+    int posteriorSize;      // 2^numBinaryFeatures
+
+    // Normalized pixel pairs, 2 * numBinaryFeatures consecutive points per fern.
+    std::vector<cv::Point2f> pixelPairs;
+
+    // Pixel-pair offsets (same layout as pixelPairs) of each distinct window size of the scanning grid
+    // and the index into them of each scale (scales with the same window size share the offsets).
+    std::vector<std::vector<cv::Point2i>> scaleOffsets;
+    std::vector<cv::Size> offsetsWindowSizes;
+    std::vector<int> scaleOffsetsIndex;
+
+    // Posterior counters (CV_16UC1), one row of posteriorSize entries per fern.
+    cv::Mat numPos;
+    cv::Mat numNeg;
+
+    // Posteriors numPos / (numPos + numNeg) quantized to [0, POSTERIOR_ONE] (CV_16UC1),
+    // same layout as the counters. Updated only when the counters change.
+    cv::Mat posteriors;
+    static constexpr int POSTERIOR_ONE = 65535;
+
+    // Largest quantized posterior of each fern.
+    std::vector<int> maxPosteriors;
+
+    // The ensemble score (sum of the quantized posteriors) of a positive window exceeds this threshold,
+    // which corresponds to an average posterior of 0.5.
+    int scoreThreshold;
+
+public:
+    EnsembleClassifier() = default;
+    EnsembleClassifier(int numFerns, int numBinaryFeatures, tld::utils::Random* rng);
+    EnsembleClassifier(const ModelFile& file);
+
+    void save(ModelWriter& writer) const;
+
+    int addScale(const cv::Size& windowSize);
+
+    int calcFern(const cv::Mat& frame, const Subwindow& window, int k) const;
+
+    void calcFerns(const cv::Mat& frame, const Subwindow* windows, int count, int* codes,
+                   FernScratch* scratch = nullptr) const;
+
+    void calcFerns(const cv::Mat& frame, const Subwindow* windows, int count, int k, int* codes,
+                   FernScratch* scratch = nullptr) const;
+
+    float classifyPatch(const cv::Mat& frame, const Subwindow& window) const;
+
+    float classifyCodes(const int* codes) const;
+
+    int scoreCodes(const int* codes) const;
+
+    float scoreToConfidence(int score) const;
+
+    int posterior(int k, int Fk) const;
+
+    FernSchedule schedule(bool reorder) const;
+
+    void update(const int* codes, bool positive);
+
+private:
+    void updatePosterior(int k, int Fk);
 
-    EnsembleClassifier(int numFerns, int numBinaryFeatures, BBox bbox, tld::utils::Random* rng);
-    float classifyPatch(const cv::Mat& frame) const;    
+    void calcFerns(const cv::Mat& frame, const Subwindow* windows, int count,
+                   int firstFern, int numFernsToCompute, int* codes, FernScratch* scratch) const;
 };
 
-} // namespace tld
\ No newline at end of file
+} // namespace tld
@@ -0,0 +1,132 @@
+#include <algorithm>  // std::max_element
+#include "FernKernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TLD_AVX2_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Portable kernel, reads the pixel pairs one by one.
+ */
+void tld::kernels::calcFernCodesScalar(const uchar* data, std::size_t /*dataSize*/,
+                                       const int* windowOffsets, int count,
+                                       const int* pairOffsets, int numFerns, int numBinaryFeatures,
+                                       int* codes)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const uchar* window = data + windowOffsets[i];
+        const int* pairs = pairOffsets;
+        for (int k = 0; k < numFerns; ++k)
+        {
+            int F = 0;
+            for (int j = 0; j < numBinaryFeatures; ++j, pairs += 2)
+            {
+                F = (F << 1) | (window[pairs[0]] > window[pairs[1]]);
+            }
+            codes[i * numFerns + k] = F;
+        }
+    }
+}
+
+
+#ifdef TLD_AVX2_DISPATCH
+
+/**
+ * AVX2 kernel, computes the codes of 8 windows at once with 32-bit gathers.
+ * The windows whose gathers would read past the end of the data are left to the scalar kernel.
+ */
+__attribute__((target("avx2")))
+void tld::kernels::calcFernCodesAVX2(const uchar* data, std::size_t dataSize,
+                                     const int* windowOffsets, int count,
+                                     const int* pairOffsets, int numFerns, int numBinaryFeatures,
+                                     int* codes)
+{
+    const int numPairOffsets = 2 * numFerns * numBinaryFeatures;
+    const std::size_t maxPairOffset = *std::max_element(pairOffsets, pairOffsets + numPairOffsets);
+    const int* base = reinterpret_cast<const int*>(data);
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    alignas(32) int laneCodes[8];
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // Every gather reads 4 bytes starting at the pixel
+        const std::size_t maxWindowOffset = *std::max_element(windowOffsets + i, windowOffsets + i + 8);
+        if (maxWindowOffset + maxPairOffset + sizeof(int) > dataSize)
+        {
+            break;
+        }
+
+        const __m256i windows = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(windowOffsets + i));
+        const int* pairs = pairOffsets;
+        for (int k = 0; k < numFerns; ++k)
+        {
+            __m256i F = _mm256_setzero_si256();
+            for (int j = 0; j < numBinaryFeatures; ++j, pairs += 2)
+            {
+                __m256i idx1 = _mm256_add_epi32(windows, _mm256_set1_epi32(pairs[0]));
+                __m256i idx2 = _mm256_add_epi32(windows, _mm256_set1_epi32(pairs[1]));
+                __m256i pix1 = _mm256_and_si256(_mm256_i32gather_epi32(base, idx1, 1), byteMask);
+                __m256i pix2 = _mm256_and_si256(_mm256_i32gather_epi32(base, idx2, 1), byteMask);
+                __m256i bit = _mm256_srli_epi32(_mm256_cmpgt_epi32(pix1, pix2), 31);
+                F = _mm256_or_si256(_mm256_slli_epi32(F, 1), bit);
+            }
+            _mm256_store_si256(reinterpret_cast<__m256i*>(laneCodes), F);
+            for (int l = 0; l < 8; ++l)
+            {
+                codes[(i + l) * numFerns + k] = laneCodes[l];
+            }
+        }
+    }
+
+    tld::kernels::calcFernCodesScalar(data, dataSize, windowOffsets + i, count - i,
+                                      pairOffsets, numFerns, numBinaryFeatures,
+                                      codes + i * numFerns);
+}
+
+
+bool tld::kernels::hasAVX2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#else
+
+void tld::kernels::calcFernCodesAVX2(const uchar* data, std::size_t dataSize,
+                                     const int* windowOffsets, int count,
+                                     const int* pairOffsets, int numFerns, int numBinaryFeatures,
+                                     int* codes)
+{
+    tld::kernels::calcFernCodesScalar(data, dataSize, windowOffsets, count,
+                                      pairOffsets, numFerns, numBinaryFeatures, codes);
+}
+
+
+bool tld::kernels::hasAVX2()
+{
+    return false;
+}
+
+#endif
+
+
+void tld::kernels::calcFernCodes(const uchar* data, std::size_t dataSize,
+                                 const int* windowOffsets, int count,
+                                 const int* pairOffsets, int numFerns, int numBinaryFeatures,
+                                 int* codes)
+{
+    if (tld::kernels::hasAVX2())
+    {
+        tld::kernels::calcFernCodesAVX2(data, dataSize, windowOffsets, count,
+                                        pairOffsets, numFerns, numBinaryFeatures, codes);
+    }
+    else
+    {
+        tld::kernels::calcFernCodesScalar(data, dataSize, windowOffsets, count,
+                                          pairOffsets, numFerns, numBinaryFeatures, codes);
+    }
+}
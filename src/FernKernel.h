@@ -0,0 +1,35 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+
+
+namespace tld
+{
+	namespace kernels
+	{
+		// All the kernels compute the fern codes of count windows which share the same pixel-pair
+		// offsets (i.e. windows of the same scale). The pixel pairs of window i are read at
+		// data[windowOffsets[i] + pairOffsets[j]], and the code of fern k is written to
+		// codes[i * numFerns + k]. dataSize is the number of bytes readable from data.
+
+		void calcFernCodesScalar(const uchar* data, std::size_t dataSize,
+								 const int* windowOffsets, int count,
+								 const int* pairOffsets, int numFerns, int numBinaryFeatures,
+								 int* codes);
+
+		void calcFernCodesAVX2(const uchar* data, std::size_t dataSize,
+							   const int* windowOffsets, int count,
+							   const int* pairOffsets, int numFerns, int numBinaryFeatures,
+							   int* codes);
+
+		bool hasAVX2();
+
+		// Dispatches to the fastest kernel supported by the CPU.
+		void calcFernCodes(const uchar* data, std::size_t dataSize,
+						   const int* windowOffsets, int count,
+						   const int* pairOffsets, int numFerns, int numBinaryFeatures,
+						   int* codes);
+
+	} // namespace kernels
+} // namespace tld
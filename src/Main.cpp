@@ -4,6 +4,7 @@
 #include <vector>
 #include <iostream>
 #include <deque>
+#include <memory>
 #include "Utils.h"
 #include "TLD.h"
 
@@ -14,7 +15,9 @@ static void readme()
               << "--input : string, input video path (or \"camera\" keyword).\n"
               << "--output : string, output video path (if now specified then no output file will be produces).\n"
               << "--gt_bboxes : string, path to the file containing ground truth bounding boxes.\n"
-              << "--evaluate : bool (1 or 0), whether to perform evaluation of the tracking results or not (gt_bboxes has to be provided)."
+              << "--evaluate : bool (1 or 0), whether to perform evaluation of the tracking results or not (gt_bboxes has to be provided).\n"
+              << "--load_model : string, path to a model file to resume from (the initial bbox is optional).\n"
+              << "--save_model : string, path to the model file to write at the end."
               << std::endl;
 }
 
@@ -22,7 +25,9 @@ static void readme()
 static const cv::String args = "{input||input video path}"
                                "{output||output video path}"
                                "{gt_bboxes||ground truth bboxes path}"
-                               "{evaluate||evaluate the tracking (only if the ground truth bboxes are provided)}";
+                               "{evaluate||evaluate the tracking (only if the ground truth bboxes are provided)}"
+                               "{load_model||model file to resume from}"
+                               "{save_model||model file to write at the end}";
 
 
 int main(int argc, char* argv[])
@@ -33,6 +38,8 @@ int main(int argc, char* argv[])
     std::string inputPath;
     std::string outputPath;
     std::string gtBboxesPath;
+    std::string loadModelPath;
+    std::string saveModelPath;
     bool evaluate = false;
     cv::CommandLineParser parser(argc, argv, args);
     if (parser.has("input"))
@@ -41,6 +48,10 @@ int main(int argc, char* argv[])
         outputPath = parser.get<cv::String>("output");
     if (parser.has("gt_bboxes"))
         gtBboxesPath = parser.get<cv::String>("gt_bboxes");
+    if (parser.has("load_model"))
+        loadModelPath = parser.get<cv::String>("load_model");
+    if (parser.has("save_model"))
+        saveModelPath = parser.get<cv::String>("save_model");
     if (parser.has("gt_bboxes") && parser.has("evaluate"))
     {
         evaluate = parser.get<bool>("evaluate");
@@ -92,14 +103,15 @@ int main(int argc, char* argv[])
 
 	// Select the initial bbox enclosing the object of interest
 	BBox initialBbox;
-    if (gtBboxesPath.empty())
+    // (a resumed model may start from its last valid bbox)
+    if (!gtBboxesPath.empty())
     {
-		initialBbox = cv::selectROI(initialFrame, false);
-		cv::destroyWindow("ROI selector");
+		initialBbox = tld::utils::bboxFromFile(gtBboxesPath, 1);
 	}
-	else
+	else if (loadModelPath.empty())
 	{
-		initialBbox = tld::utils::bboxFromFile(gtBboxesPath, 1);
+		initialBbox = cv::selectROI(initialFrame, false);
+		cv::destroyWindow("ROI selector");
 	}
 
     std::cout << "Initial bbox: ("
@@ -112,7 +124,10 @@ int main(int argc, char* argv[])
     // ------------------
     // Initialize the TLD
     // ------------------
-    tld::TLD myTLD(initialFrameGray, initialBbox);
+    std::unique_ptr<tld::TLD> tldInstance = loadModelPath.empty()
+        ? std::make_unique<tld::TLD>(initialFrameGray, initialBbox)
+        : std::make_unique<tld::TLD>(initialFrameGray, initialBbox, loadModelPath);
+    tld::TLD& myTLD = *tldInstance;
 
     // Main video loop
     cv::Mat newFrame;
@@ -214,15 +229,35 @@ int main(int argc, char* argv[])
                 cv::Point(10, newFrame.rows - 130),
                 cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
         }
+        const tld::DetectionStats& stats = myTLD.detectionResult.stats;
+        const tld::TemplateCounters& posCounters = myTLD.objectModel.positiveCounters;
+        const tld::TemplateCounters& negCounters = myTLD.objectModel.negativeCounters;
+        cv::putText(newFrame, "Templates: positive " + std::to_string(myTLD.objectModel.positiveTemplates.size())
+                    + " (rejected " + std::to_string(posCounters.numRejected) + ", evicted " + std::to_string(posCounters.numEvicted) + ")"
+                    + ", negative " + std::to_string(myTLD.objectModel.negativeTemplates.size())
+                    + " (rejected " + std::to_string(negCounters.numRejected) + ", evicted " + std::to_string(negCounters.numEvicted) + ")",
+            cv::Point(10, newFrame.rows - 190),
+            cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
+        cv::putText(newFrame, "Detection [ms]: smoothing " + tld::utils::to_string(stats.smoothingTime, 2)
+                    + ", integral " + tld::utils::to_string(stats.integralTime, 2)
+                    + ", scanning " + tld::utils::to_string(stats.scanningTime, 2)
+                    + ", templates " + tld::utils::to_string(stats.templateMatchingTime, 2),
+            cv::Point(10, newFrame.rows - 160),
+            cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
         cv::putText(newFrame, "Frame size: " + std::to_string(newFrame.rows) + "x" + std::to_string(newFrame.cols),
             cv::Point(10, newFrame.rows - 100),
             cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
 
-        cv::putText(newFrame, "Frame: " + std::to_string(frameCounter) + "/" + std::to_string(totalFrames),
+        cv::putText(newFrame, "Frame: " + std::to_string(frameCounter) + "/" + std::to_string(totalFrames)
+                    + " (detector skipped: " + std::to_string(myTLD.numDetectorSkips) + ")",
                     cv::Point(10, newFrame.rows - 70),
                     cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
 
-        cv::putText(newFrame, "Subwindows: " + std::to_string(myTLD.detector.ensClfPool.size()),
+        cv::putText(newFrame, "Subwindows: " + std::to_string(myTLD.detectionResult.stats.numWindows)
+                    + "/" + std::to_string(myTLD.detector.grid.size())
+                    + " (skipped: " + tld::utils::to_string(100.0f * myTLD.detectionResult.stats.skippedRate(), 1) + "%, "
+                    + "variance rejected: " + tld::utils::to_string(100.0f * myTLD.detectionResult.stats.varianceRejectionRate(), 1) + "%, "
+                    + tld::utils::to_string(myTLD.detectionResult.stats.averageFernsEvaluated(), 1) + " ferns/window)",
                     cv::Point(10, newFrame.rows - 40),
                     cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(127, 0, 255), 2);
 
@@ -275,6 +310,12 @@ int main(int argc, char* argv[])
         std::cout << "Recall: " << recall << std::endl;
     }
 
+    if (!saveModelPath.empty())
+    {
+        myTLD.save(saveModelPath);
+        std::cout << "Model saved to " << saveModelPath << std::endl;
+    }
+
     std::cout << "Done!" << std::endl;
 
     // Release the video capture object
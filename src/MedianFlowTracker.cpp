@@ -1,4 +1,5 @@
 #include <opencv2/video/tracking.hpp>
+#include <algorithm>  // std::copy
 #include <math.h>  // fabs
 #include <cmath>  // hypot
 #include "MedianFlowTracker.h"
@@ -74,25 +75,51 @@ std::vector<cv::Point2f> tld::MedianFlowTracker::generatePoints(const BBox& bbox
  */
 void tld::MedianFlowTracker::reinitialize(const cv::Mat& frame, const BBox& bbox)
 {
+    // The pyramid is kept if the frame is the one of the last track call (the re-initialization by the fusion)
+    if (frame.data != this->previousFrame.data || frame.size() != this->previousFrame.size())
+    {
+        this->previousPyramid.clear();
+    }
     this->previousFrame = frame;
     this->previousBbox = bbox;
     this->previousPoints = generatePoints(bbox);
 }
 
 
+/**
+ * Builds the pyramid of the frame for calcOpticalFlowPyrLK, reusing the allocations of the pyramid.
+ */
+void tld::MedianFlowTracker::buildPyramid(const cv::Mat &frame, std::vector<cv::Mat> &pyramid) const
+{
+    cv::buildOpticalFlowPyramid(frame, pyramid, params->LK_WIN_SIZE, params->MAX_PYR_LEVEL, true);
+}
+
+
+/**
+ * Makes the frame tracked last, with its pyramid newPyramid, the previous frame.
+ */
+void tld::MedianFlowTracker::setPrevious(const cv::Mat &frame, const BBox &bbox)
+{
+    this->previousFrame = frame;
+    this->previousPyramid.swap(this->newPyramid);  // the old pyramid is reused for the next frame
+    this->previousBbox = bbox;
+    this->previousPoints = generatePoints(bbox);
+}
+
+
 /**
 * Updates the forwardStatus vector by computing the Forward-Backward error values.
 * The forwardStatus[i] is set to 1 if the FB error of the i-th point is less than
 * the median of the FB erors of all the points, otherwise it is set to 0.
 */
-void tld::MedianFlowTracker::checkFB(const cv::Mat &newFrame,
+void tld::MedianFlowTracker::checkFB(const std::vector<cv::Mat> &newFramePyramid,
                                     const std::vector<cv::Point2f> &newPoints,
                                     std::vector<unsigned char> &forwardStatus)
 {
     std::vector<unsigned char> backwardStatus;
 	std::vector<float> err;
     std::vector<cv::Point2f> pointsReprojected;
-    cv::calcOpticalFlowPyrLK(newFrame, this->previousFrame,
+    cv::calcOpticalFlowPyrLK(newFramePyramid, this->previousPyramid,
                              newPoints, pointsReprojected,
                              backwardStatus, err,
                              params->LK_WIN_SIZE,
@@ -148,33 +175,30 @@ void tld::MedianFlowTracker::checkFB(const cv::Mat &newFrame,
 
 /**
 * Updates the forwardStatus vector based on the NCC values of patches around ther tracked point.
+* The NCC of all the points is computed in one batch into the scratch buffers of the tracker.
 */
 void tld::MedianFlowTracker::checkNCC(const cv::Mat &newFrame,
                                       const std::vector<cv::Point2f> &newPoints,
                                       std::vector<unsigned char> &forwardStatus)
 {
-    std::vector<float> nccValues;
-    for (int i = 0; i < params->TOTAL_NUM_POINTS; ++i)
-    {
-        if (forwardStatus[i] == 1)
-        {
-            cv::Mat patch1 = tld::utils::getPatch(this->previousFrame, this->previousPoints[i],
-                                                  params->NCC_PATCH_SIZE);
-            cv::Mat patch2 = tld::utils::getPatch(newFrame, newPoints[i],
-                                                  params->NCC_PATCH_SIZE);
-            float ncc = tld::utils::computeNCC(patch1, patch2);
-            nccValues.push_back(ncc);
-        }
-    }
+    const int numPoints = params->TOTAL_NUM_POINTS;
+    this->nccValues.resize(numPoints);
+    this->nccMedianValues.resize(numPoints);
+
+    int numValues = tld::utils::computeNCCBatch(this->previousFrame, this->previousPoints.data(),
+                                                newFrame, newPoints.data(),
+                                                forwardStatus.data(), numPoints,
+                                                params->NCC_PATCH_SIZE, this->nccValues.data());
 
-    float medianNCC = tld::utils::median(nccValues);
+    std::copy(this->nccValues.begin(), this->nccValues.begin() + numValues, this->nccMedianValues.begin());
+    float medianNCC = tld::utils::median(this->nccMedianValues.data(), numValues);
 
     int j = 0;
-    for (int i = 0; i < params->TOTAL_NUM_POINTS; ++i)
+    for (int i = 0; i < numPoints; ++i)
     {  
         if (forwardStatus[i] == 1)
         {
-            if (nccValues[j] >= medianNCC)
+            if (this->nccValues[j] >= medianNCC)
             {
                 forwardStatus[i] = 1;
             }
@@ -201,10 +225,17 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     }
     
     // Calculate optical flow using the iterative Lucas-Kanade method with pyramids.
+    // The pyramid of the previous frame was built when it was the new frame.
+    if (this->previousPyramid.empty())
+    {
+        this->buildPyramid(this->previousFrame, this->previousPyramid);
+    }
+    this->buildPyramid(newFrame, this->newPyramid);
+
     std::vector<cv::Point2f> newPoints;
     std::vector<unsigned char> forwardStatus;
 	std::vector<float> err;
-    cv::calcOpticalFlowPyrLK(this->previousFrame, newFrame,
+    cv::calcOpticalFlowPyrLK(this->previousPyramid, this->newPyramid,
                              this->previousPoints, newPoints,
                              forwardStatus, err,
                              params->LK_WIN_SIZE,
@@ -213,12 +244,13 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
 
     // Compute the forward-backward (FB) errors and update the forwardStatus.
     // At every iteration the FB check cuts the number of points to half.
-    tld::MedianFlowTracker::checkFB(newFrame, newPoints, forwardStatus);
+    tld::MedianFlowTracker::checkFB(this->newPyramid, newPoints, forwardStatus);
 
     // Compute the normalized correlation coefficient (NCC) and update the forwardStatus.
     tld::MedianFlowTracker::checkNCC(newFrame, newPoints, forwardStatus);
 
     // Select points that where successfully tracked.
+    std::vector<cv::Point2f> trackedPreviousPoints;
     std::vector<cv::Point2f> trackedPoints;
     std::vector<float> translationsX;
     std::vector<float> translationsY;
@@ -226,6 +258,7 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     {
         if(forwardStatus[i] == 1)
         {
+            trackedPreviousPoints.push_back(this->previousPoints[i]);
             trackedPoints.push_back(newPoints[i]);
             float dx = newPoints[i].x - this->previousPoints[i].x;
             float dy = newPoints[i].y - this->previousPoints[i].y;
@@ -239,7 +272,7 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     {
         // Tracking failed, reinitialize the tracker with empty bbox and return empty bbox.
         std::cout << "Tracking failed because LK failed" << std::endl;
-        reinitialize(newFrame, BBox());
+        this->setPrevious(newFrame, BBox());
         return BBox();
     }
     
@@ -260,7 +293,7 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     {
         // Tracking failed, reinitialize the tracker with empty bbox and return empty bbox.
         std::cout << "Tracking failed because median displacement is too big" << std::endl;
-        reinitialize(newFrame, BBox());
+        this->setPrevious(newFrame, BBox());
         return BBox();
     }
 
@@ -269,33 +302,9 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     // Similarly, compute the pairwise distances between all the newPoints.
     // Second, compute the ratios between the corresponding distances.
     // Finaly, use the median of the ratios as the change in the scale of the new bbox.
-    std::vector<float> scales;
-    for (std::size_t i = 0; i < newPoints.size(); ++i)
-    {
-        if(forwardStatus[i] == 1)
-        {
-            for (std::size_t j = i + 1; j < newPoints.size(); ++j)
-            {
-                if(forwardStatus[j] == 1)
-                {
-                    cv::Point2f p1 = this->previousPoints[i] - this->previousPoints[j];
-                    cv::Point2f p2 = newPoints[i] - newPoints[j];
-                    float s1 = std::hypot(p1.x, p1.y);
-                    float s2 = std::hypot(p2.x, p2.y);
-                    if (s1 != 0 && s2 != 0)
-                    {
-                        scales.push_back(s2 / s1);
-                    }
-                }
-            }
-        }
-    }
-
-    float newBboxScale = 1.0f;
-    if (!scales.empty())
-    {
-        newBboxScale = tld::utils::median(scales);
-    }
+    // With SCALE_MEDIAN_TOLERANCE > 0 the median is estimated from a fixed number of random pairs.
+    float newBboxScale = tld::utils::medianScaleChange(trackedPreviousPoints, trackedPoints,
+                                                       params->SCALE_MEDIAN_TOLERANCE, this->rng);
 
     BBox newBbox;
     newBbox.x = this->previousBbox.x + mDx;
@@ -306,7 +315,7 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     if (!tld::utils::bboxWithinImage(newBbox, newFrame))
     {
         std::cout << "bbox crossed the boundaries" << std::endl;
-        reinitialize(newFrame, BBox());
+        this->setPrevious(newFrame, BBox());
         return BBox();
     }
 
@@ -314,12 +323,12 @@ BBox tld::MedianFlowTracker::track(const cv::Mat &newFrame)
     if (newBbox.width <= 5 || newBbox.height <= 5)
     {
         std::cout << "bbox too small" << std::endl;
-        reinitialize(newFrame, BBox());
+        this->setPrevious(newFrame, BBox());
         return BBox();
     }
 
     // Reinitialize the tracker
-    reinitialize(newFrame, newBbox);
+    this->setPrevious(newFrame, newBbox);
 
     return newBbox;
 }
@@ -30,10 +30,24 @@ namespace tld
         std::vector<cv::Point2f> previousPoints;
         BBox previousBbox;
 
+        // Optical-flow pyramids (with derivatives) of previousFrame, empty until needed, and of the new frame.
+        // The pyramid of every frame is built once, passed to the forward and backward LK
+        // and kept for the next frame.
+        std::vector<cv::Mat> previousPyramid;
+        std::vector<cv::Mat> newPyramid;
+
+        // Scratch of checkNCC, sized once to TOTAL_NUM_POINTS
+        std::vector<float> nccValues;
+        std::vector<float> nccMedianValues;
+
         std::vector<cv::Point2f> generatePoints(const BBox& bbox);
 
+        void buildPyramid(const cv::Mat &frame, std::vector<cv::Mat> &pyramid) const;
+
+        void setPrevious(const cv::Mat &frame, const BBox &bbox);
+
         // Forward-Backward (FB) error
-        void checkFB(const cv::Mat &newFrame,
+        void checkFB(const std::vector<cv::Mat> &newFramePyramid,
                      const std::vector<cv::Point2f> &newPoints,
                      std::vector<unsigned char> &forwardStatus);
 
@@ -0,0 +1,208 @@
+#include <opencv2/opencv.hpp>
+#include <cstdio>   // std::rename, std::remove
+#include <cstring>  // std::memcpy, std::memcmp
+#include <fstream>
+#include "ModelFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close
+#endif
+
+
+static const char MAGIC[8] = {'T', 'L', 'D', 'M', 'O', 'D', 'E', 'L'};
+static const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct ModelFileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrderMark;
+    std::uint32_t numSections;
+    std::uint32_t reserved;
+    std::uint64_t fileSize;
+};
+
+
+static std::size_t alignUp(std::size_t offset)
+{
+    const std::size_t alignment = tld::ModelFile::SECTION_ALIGNMENT;
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+
+/**
+ * Adds a copy of the data as the section with the given id (replacing a previous one).
+ */
+void tld::ModelWriter::addSection(std::uint32_t id, const void* data, std::size_t size)
+{
+    const char* const bytes = static_cast<const char*>(data);
+    for (auto& section : this->sections)
+    {
+        if (section.first == id)
+        {
+            section.second.assign(bytes, bytes + size);
+            return;
+        }
+    }
+    this->sections.emplace_back(id, std::vector<char>(bytes, bytes + size));
+}
+
+
+/**
+ * Writes the header, the section table and the sections to a temporary file in the same
+ * directory, which then replaces the file.
+ */
+void tld::ModelWriter::write(const std::string& filename) const
+{
+    std::vector<ModelFile::SectionEntry> entries;
+    std::size_t offset = alignUp(sizeof(ModelFileHeader) + this->sections.size() * sizeof(ModelFile::SectionEntry));
+    for (const auto& section : this->sections)
+    {
+        entries.push_back({section.first, 0, offset, section.second.size()});
+        offset = alignUp(offset + section.second.size());
+    }
+
+    ModelFileHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = ModelFile::VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.numSections = static_cast<std::uint32_t>(entries.size());
+    header.reserved = 0;
+    header.fileSize = offset;
+
+    std::vector<char> contents(offset, 0);
+    std::memcpy(contents.data(), &header, sizeof(header));
+    std::memcpy(contents.data() + sizeof(header), entries.data(), entries.size() * sizeof(ModelFile::SectionEntry));
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        std::memcpy(contents.data() + entries[i].offset, this->sections[i].second.data(), entries[i].size);
+    }
+
+    // The target may be the file a tracker was loaded from, which is still mapped (see ModelFile):
+    // truncating it would invalidate the pages of the mapping, so it is replaced with a new file.
+    const std::string temporaryFilename = filename + ".tmp";
+    std::ofstream file(temporaryFilename, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    file.close();
+    if (!file)
+    {
+        std::remove(temporaryFilename.c_str());
+        CV_Error(cv::Error::StsError, "Cannot write the model file " + filename);
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());  // rename does not replace an existing file
+#endif
+    if (std::rename(temporaryFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(temporaryFilename.c_str());
+        CV_Error(cv::Error::StsError, "Cannot replace the model file " + filename);
+    }
+}
+
+
+/**
+ * Maps the model file and validates its header and section table.
+ */
+tld::ModelFile::ModelFile(const std::string& filename)
+{
+#ifndef _WIN32
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        CV_Error(cv::Error::StsError, "Cannot open the model file " + filename);
+    }
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        this->size = static_cast<std::size_t>(fileStat.st_size);
+        void* const address = ::mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            this->data = static_cast<char*>(address);
+            this->isMapped = true;
+        }
+    }
+    ::close(fd);
+#endif
+    if (!this->isMapped)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            CV_Error(cv::Error::StsError, "Cannot open the model file " + filename);
+        }
+        this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        this->data = this->buffer.data();
+        this->size = this->buffer.size();
+    }
+
+    ModelFileHeader header;
+    CV_Assert(this->size >= sizeof(header));
+    std::memcpy(&header, this->data, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.byteOrderMark != BYTE_ORDER_MARK)
+    {
+        CV_Error(cv::Error::StsError, filename + " is not a model file of this platform");
+    }
+    if (header.version != VERSION)
+    {
+        CV_Error(cv::Error::StsError, "Unsupported version " + std::to_string(header.version) + " of the model file " + filename);
+    }
+    CV_Assert(header.fileSize == this->size);
+    CV_Assert(sizeof(header) + header.numSections * sizeof(SectionEntry) <= this->size);
+
+    this->entries.resize(header.numSections);
+    std::memcpy(this->entries.data(), this->data + sizeof(header), header.numSections * sizeof(SectionEntry));
+    for (const SectionEntry& entry : this->entries)
+    {
+        CV_Assert(entry.offset % SECTION_ALIGNMENT == 0 && entry.offset <= this->size && entry.size <= this->size - entry.offset);
+    }
+}
+
+
+tld::ModelFile::~ModelFile()
+{
+#ifndef _WIN32
+    if (this->isMapped)
+    {
+        ::munmap(this->data, this->size);
+    }
+#endif
+}
+
+
+bool tld::ModelFile::hasSection(std::uint32_t id) const
+{
+    for (const SectionEntry& entry : this->entries)
+    {
+        if (entry.id == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Returns the data of the section, which has to be of the given size.
+ * The data is writable; the changes stay private to the process and are not written to the file.
+ */
+void* tld::ModelFile::section(std::uint32_t id, std::size_t size) const
+{
+    for (const SectionEntry& entry : this->entries)
+    {
+        if (entry.id == id)
+        {
+            if (entry.size != size)
+            {
+                CV_Error(cv::Error::StsError, "Unexpected size of the section " + std::to_string(id) + " of the model file");
+            }
+            return this->data + entry.offset;
+        }
+    }
+    CV_Error(cv::Error::StsError, "Missing section " + std::to_string(id) + " of the model file");
+    return nullptr;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace tld
+{
+/**
+ * Identifiers of the sections of a model file. The sections of a template store
+ * are numbered from its base (POSITIVE_TEMPLATES or NEGATIVE_TEMPLATES).
+ */
+enum ModelSection : std::uint32_t
+{
+    TLD_STATE = 1,
+    ENSEMBLE_INFO = 2,
+    ENSEMBLE_PIXEL_PAIRS = 3,
+    ENSEMBLE_NUM_POS = 4,
+    ENSEMBLE_NUM_NEG = 5,
+    ENSEMBLE_POSTERIORS = 6,
+    GRID_INFO = 7,
+    GRID_SCALES = 8,
+    DETECTOR_STATE = 9,
+    POSITIVE_TEMPLATES = 16,
+    NEGATIVE_TEMPLATES = 32,
+    TEMPLATES_INFO = 0,  // offsets within the sections of a template store
+    TEMPLATES_PATCHES = 1,
+    TEMPLATES_VECTORS = 2,
+    TEMPLATES_SIGNATURES = 3,  // only if the store tracks redundancy (TEMPLATE_ADMISSION)
+    TEMPLATES_SIMILARITIES = 4
+};
+
+
+/**
+ * Collects the sections of a model file and writes them at once.
+ *
+ * File layout (native byte order, checked on loading):
+ *    header: magic "TLDMODEL", version, byte-order mark, number of sections, file size
+ *    section table: id, offset and size of every section
+ *    sections, each aligned to SECTION_ALIGNMENT bytes
+ */
+class ModelWriter
+{
+public:
+    void addSection(std::uint32_t id, const void* data, std::size_t size);
+
+    template<typename T>
+    void addSection(std::uint32_t id, const T& value)
+    {
+        this->addSection(id, &value, sizeof(T));
+    }
+
+    void write(const std::string& filename) const;
+
+private:
+    std::vector<std::pair<std::uint32_t, std::vector<char>>> sections;
+};
+
+
+/**
+ * Model file mapped into memory (private copy-on-write mapping), so that the learned arrays
+ * are used in place without parsing and processes loading the same file share its pages
+ * until they modify them. The mapping lives as long as the ModelFile, which has to outlive
+ * every object using its sections. Without mmap (Windows), the file is read into memory.
+ */
+class ModelFile
+{
+public:
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::size_t SECTION_ALIGNMENT = 64;
+
+    explicit ModelFile(const std::string& filename);
+    ~ModelFile();
+
+    ModelFile(const ModelFile&) = delete;
+    ModelFile& operator=(const ModelFile&) = delete;
+
+    bool hasSection(std::uint32_t id) const;
+
+    void* section(std::uint32_t id, std::size_t size) const;
+
+    template<typename T>
+    T* section(std::uint32_t id, std::size_t count = 1) const
+    {
+        return static_cast<T*>(this->section(id, count * sizeof(T)));
+    }
+
+    template<typename T>
+    T value(std::uint32_t id) const
+    {
+        return *this->section<T>(id);
+    }
+
+private:
+    struct SectionEntry
+    {
+        std::uint32_t id;
+        std::uint32_t reserved;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    char* data = nullptr;
+    std::size_t size = 0;
+    bool isMapped = false;
+    std::vector<char> buffer;  // contents of the file if it is not mapped
+    std::vector<SectionEntry> entries;
+
+    friend class ModelWriter;
+};
+
+} // namespace tld
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+
+
+namespace tld
+{
+	namespace kernels
+	{
+		// NCC (as cv::TM_CCOEFF_NORMED) of two width x height uint8 patches whose rows start
+		// stepA and stepB bytes apart. The sums are accumulated exactly in integers, the NCC
+		// of a constant patch is 0.
+
+		float nccU8Scalar(const uchar* a, std::size_t stepA,
+						  const uchar* b, std::size_t stepB,
+						  int width, int height);
+
+		float nccU8AVX2(const uchar* a, std::size_t stepA,
+						const uchar* b, std::size_t stepB,
+						int width, int height);
+
+		// Dispatches to the fastest kernel supported by the CPU for the patch width
+		// (the AVX2 kernel needs rows of at least 16 pixels).
+		float nccU8(const uchar* a, std::size_t stepA,
+					const uchar* b, std::size_t stepB,
+					int width, int height);
+
+		// Kernel nccU8 dispatches to for patches of up to maxWidth pixels, for loops over
+		// many patches that resolve the dispatch once.
+		using NccU8Kernel = float (*)(const uchar* a, std::size_t stepA,
+									  const uchar* b, std::size_t stepB,
+									  int width, int height);
+
+		NccU8Kernel nccU8Kernel(int maxWidth);
+
+		// Dot product of two float vectors of length n, i.e. the NCC of two patches
+		// normalized with tld::utils::normalizePatch.
+
+		float dotF32Scalar(const float* a, const float* b, int n);
+
+		float dotF32AVX2(const float* a, const float* b, int n);
+
+		// Dispatches to the fastest kernel supported by the CPU.
+		float dotF32(const float* a, const float* b, int n);
+
+		// Fastest dot-product kernel supported by the CPU, for loops over many vectors
+		// that resolve the dispatch once.
+		using DotF32Kernel = float (*)(const float* a, const float* b, int n);
+
+		DotF32Kernel dotF32Kernel();
+
+	} // namespace kernels
+} // namespace tld
@@ -2,6 +2,7 @@
 #include <cmath>      // M_PI, std::hypot, std::cos, std::sin
 #include <functional>  // std::bind
 #include "ObjectModel.h"
+#include "PatchNormalizer.h"
 #include "Utils.h"
 
 
@@ -16,7 +17,14 @@ tld::ObjectModel::ObjectModel(const cv::Mat& initialFrame,
 
     this->params = params;
     this->rng = rng;
+    const int indexDimensions = params->TEMPLATE_INDEX ? params->TEMPLATE_INDEX_DIMENSIONS : 0;
+    this->positiveTemplates = TemplateStore(params->TEMPLATE_SIZE, params->MAX_OBJ_MODEL_SIZE,
+                                            indexDimensions, params->TEMPLATE_INDEX_CANDIDATES, params->TEMPLATE_ADMISSION);
+    this->negativeTemplates = TemplateStore(params->TEMPLATE_SIZE, params->MAX_OBJ_MODEL_SIZE,
+                                            indexDimensions, params->TEMPLATE_INDEX_CANDIDATES, params->TEMPLATE_ADMISSION);
     cv::Mat positivePatch = initialFrame(initialBbox);
+    tld::PatchNormalizer normalizer(params->TEMPLATE_SIZE, params->AREA_RESAMPLING);
+    normalizer.setFrame(initialFrame);
 
     // Create warps of the initial positive template.
     for (size_t i = 0; i < params->INIT_OBJ_MODEL_SIZE; ++i)
@@ -35,10 +43,7 @@ tld::ObjectModel::ObjectModel(const cv::Mat& initialFrame,
                             initialBbox.y - rng->randf(-yShift, yShift),
                             initialBbox.width,
                             initialBbox.height);
-        cv::Mat posShiftedBboxPatch = initialFrame(posShiftedBbox & BBox(0, 0, initialFrame.cols, initialFrame.rows));
-        cv::Mat posShiftedBboxPatchResized;
-        cv::resize(posShiftedBboxPatch, posShiftedBboxPatchResized, params->TEMPLATE_SIZE, 0, 0, cv::INTER_CUBIC);
-        this->positiveTemplates.push_back(posShiftedBboxPatchResized);
+        this->addPositiveTemplate(normalizer.patch(posShiftedBbox & BBox(0, 0, initialFrame.cols, initialFrame.rows)));
     }
 
     // Create random negative patches outside of the initial positive patch.
@@ -49,10 +54,7 @@ tld::ObjectModel::ObjectModel(const cv::Mat& initialFrame,
         BBox negNearBbox = this->createNearbyBbox(initialBbox, 0.2f, r, dr, 0.3f);
         if (negNearBbox.area() >= params->MIN_AREA)
         {
-            cv::Mat negNearBboxPatch = initialFrame(negNearBbox & BBox(0, 0, initialFrame.cols, initialFrame.rows));
-            cv::Mat negNearBboxPatchResized;
-            cv::resize(negNearBboxPatch, negNearBboxPatchResized, params->TEMPLATE_SIZE, 0, 0, cv::INTER_CUBIC);
-            this->negativeTemplates.push_back(negNearBboxPatchResized);
+            this->addNegativeTemplate(normalizer.patch(negNearBbox & BBox(0, 0, initialFrame.cols, initialFrame.rows)));
         }
     }
 
@@ -60,50 +62,90 @@ tld::ObjectModel::ObjectModel(const cv::Mat& initialFrame,
 }
 
 
-void tld::ObjectModel::addPositiveTemplate(cv::Mat positiveTemplate)
+/**
+ * Constructor of ObjectModel from a model file (see save). The templates have to be
+ * of TEMPLATE_SIZE and the template sets of MAX_OBJ_MODEL_SIZE.
+ */
+tld::ObjectModel::ObjectModel(const ModelFile& file,
+                              Params* params,
+                              tld::utils::Random* rng)
 {
+    this->params = params;
+    this->rng = rng;
+    const int indexDimensions = params->TEMPLATE_INDEX ? params->TEMPLATE_INDEX_DIMENSIONS : 0;
+    this->positiveTemplates = TemplateStore(file, POSITIVE_TEMPLATES, indexDimensions,
+                                            params->TEMPLATE_INDEX_CANDIDATES, params->TEMPLATE_ADMISSION);
+    this->negativeTemplates = TemplateStore(file, NEGATIVE_TEMPLATES, indexDimensions,
+                                            params->TEMPLATE_INDEX_CANDIDATES, params->TEMPLATE_ADMISSION);
 
-    if (this->positiveTemplates.size() < params->MAX_OBJ_MODEL_SIZE)
-    {
-        this->positiveTemplates.push_back(positiveTemplate);
-    }
-    else
+    for (const TemplateStore* templates : {&this->positiveTemplates, &this->negativeTemplates})
     {
-        if (params->RAND_REPLACEMENT)
+        if (templates->patchSize() != params->TEMPLATE_SIZE || templates->maxSize() != params->MAX_OBJ_MODEL_SIZE)
         {
-            int randIndex = rng->randi(0, this->positiveTemplates.size() - 1);
-            this->positiveTemplates[randIndex] = positiveTemplate;
-        }
-        else
-        {
-            this->positiveTemplates.pop_front();
-            this->positiveTemplates.push_back(positiveTemplate);
+            CV_Error(cv::Error::StsError, "The templates of the model file do not match TEMPLATE_SIZE and MAX_OBJ_MODEL_SIZE");
         }
     }
+
+    std::cout << "Object model loaded (" << this->positiveTemplates.size() << " positive, "
+              << this->negativeTemplates.size() << " negative templates)." << std::endl;
+}
+
+
+/**
+ * Adds both template sets to the model file.
+ */
+void tld::ObjectModel::save(ModelWriter& writer) const
+{
+    this->positiveTemplates.save(writer, POSITIVE_TEMPLATES);
+    this->negativeTemplates.save(writer, NEGATIVE_TEMPLATES);
+}
+
+
+void tld::ObjectModel::addPositiveTemplate(cv::Mat positiveTemplate)
+{
+    this->addTemplate(this->positiveTemplates, this->positiveCounters, positiveTemplate);
 }
 
 
 void tld::ObjectModel::addNegativeTemplate(cv::Mat negativeTemplate)
 {
-    if (this->negativeTemplates.size() < params->MAX_OBJ_MODEL_SIZE)
-    {
-        this->negativeTemplates.push_back(negativeTemplate);
+    this->addTemplate(this->negativeTemplates, this->negativeCounters, negativeTemplate);
+}
 
-    }
-    else
+
+/**
+ * Adds the template to the store, replacing a random or the oldest template of a full store.
+ * With TEMPLATE_ADMISSION, a template redundant with one of the store is rejected,
+ * and the most redundant template of a full store is replaced instead.
+ */
+void tld::ObjectModel::addTemplate(TemplateStore& templates, TemplateCounters& counters, const cv::Mat& newTemplate)
+{
+    if (params->TEMPLATE_ADMISSION)
     {
-        if (params->RAND_REPLACEMENT)
+        if (templates.isRedundant(newTemplate, params->ADMISSION_NCC_THRESHOLD, params->ADMISSION_HASH_DISTANCE))
         {
-            int randIndex = rng->randi(0, this->negativeTemplates.size() - 1);
-            this->negativeTemplates[randIndex] = negativeTemplate;
+            counters.numRejected++;
+            return;
         }
-        else
+        if (templates.full())
         {
-            this->negativeTemplates.pop_front();
-            this->negativeTemplates.push_back(negativeTemplate);
+            templates.replace(templates.mostRedundant(), newTemplate);
+            counters.numEvicted++;
+            counters.numAdded++;
+            return;
         }
+    }
 
+    if (templates.full() && params->RAND_REPLACEMENT)
+    {
+        int randIndex = rng->randi(0, templates.size() - 1);
+        templates.replace(randIndex, newTemplate);
+    }
+    else
+    {
+        templates.push(newTemplate);
     }
+    counters.numAdded++;
 }
 
 
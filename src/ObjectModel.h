@@ -2,8 +2,9 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
-#include <deque>
+#include "ModelFile.h"
 #include "Params.h"
+#include "TemplateStore.h"
 #include "Utils.h"
 
 
@@ -11,14 +12,29 @@ using BBox = cv::Rect2f;
 
 namespace tld
 {
+/**
+ * Counters of the templates handed to a template set of the object model.
+ */
+struct TemplateCounters
+{
+    std::size_t numAdded = 0;     // templates added to the set
+    std::size_t numRejected = 0;  // templates rejected as redundant (TEMPLATE_ADMISSION)
+    std::size_t numEvicted = 0;   // most redundant templates evicted from the full set (TEMPLATE_ADMISSION)
+};
+
+
 class ObjectModel
 {
 public:
     Params* params;
 
-    std::deque<cv::Mat> positiveTemplates;
+    TemplateStore positiveTemplates;
+
+    TemplateStore negativeTemplates;
+
+    TemplateCounters positiveCounters;
 
-    std::deque<cv::Mat> negativeTemplates;
+    TemplateCounters negativeCounters;
 
     ObjectModel() = default;
 
@@ -27,6 +43,12 @@ public:
                 Params* params,
                 tld::utils::Random* rng);
 
+    ObjectModel(const ModelFile& file,
+                Params* params,
+                tld::utils::Random* rng);
+
+    void save(ModelWriter& writer) const;
+
     void addPositiveTemplate(cv::Mat positiveTemplate);
 
     void addNegativeTemplate(cv::Mat negativeTemplate);
@@ -34,6 +56,8 @@ public:
 private:
     tld::utils::Random* rng;
     
+    void addTemplate(TemplateStore& templates, TemplateCounters& counters, const cv::Mat& newTemplate);
+
     cv::Point2f getRandomPointInsideBbox(const BBox& bbox);
 
     BBox createNearbyBbox(const BBox& bbox, float marginFrac, float r, float rFrac, float dtheta);
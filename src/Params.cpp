@@ -16,10 +16,12 @@ tld::Params::Params()
     NCC_PATCH_SIZE = cv::Size(10, 10);
     FB_THRESHOLD = 10.0f;
     MAX_MEDIAN_DISPLACEMENT = 10.0f;
+    SCALE_MEDIAN_TOLERANCE = 0.0f;
     TERM_CRITERIA = cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 10, 0.03);
 
     // Cascade classifier parameters
     VARIANCE_FRACTION = 0.7f;
+    FERN_SMOOTHING_SIGMA = 3.0f;
     OVERLAP_THRESHOLD = 0.5f;
     NUM_FERNS = 5;
     NUM_BINARY_FEATURES = 4;
@@ -28,7 +30,23 @@ tld::Params::Params()
     MAX_SCALE = 2.2f;
     WIDTH_FRACTION = MIN_SCALE / 2.0f;
     HEIGHT_FRACTION = MIN_SCALE / 2.0f;
+    PYRAMID_SCANNING = false;
     MIN_AREA = 25.0f;
+    NUM_DETECTION_THREADS = 1;
+    EARLY_REJECTION = true;
+    REORDER_FERNS = true;
+    ROI_DETECTION = false;
+    SEARCH_REGION_SCALE = 2.0f;
+    SEARCH_MOTION_FACTOR = 3.0f;
+    FULL_SCAN_INTERVAL = 10;
+    TEMPORAL_SKIPPING = false;
+    NEGATIVE_STREAK_FRAMES = 5;
+    RECHECK_INTERVAL = 4;
+    FULL_SWEEP_INTERVAL = 30;
+    DETECTOR_SCHEDULING = false;
+    MIN_DETECTION_INTERVAL = 1;
+    MAX_DETECTION_INTERVAL = 8;
+    SKIP_DETECTION_MARGIN = 0.1f;
 
     // TLD parameters
     THETA_MINUS = 0.65f;
@@ -37,8 +55,15 @@ tld::Params::Params()
     // Object model parameters
     RAND_REPLACEMENT = false;
     TEMPLATE_SIZE = cv::Size(15, 15);
+    AREA_RESAMPLING = false;
     INIT_OBJ_MODEL_SIZE = 20;
     MAX_OBJ_MODEL_SIZE = 40;
+    TEMPLATE_INDEX = false;
+    TEMPLATE_INDEX_DIMENSIONS = 16;
+    TEMPLATE_INDEX_CANDIDATES = 0;
+    TEMPLATE_ADMISSION = false;
+    ADMISSION_NCC_THRESHOLD = 0.95f;
+    ADMISSION_HASH_DISTANCE = 10;
 }
 
 
@@ -69,6 +94,8 @@ void tld::Params::read(const std::string& filename)
         FB_THRESHOLD = static_cast<float>(fs["FB_THRESHOLD"]);
     if (!fs["MAX_MEDIAN_DISPLACEMENT"].empty())
         MAX_MEDIAN_DISPLACEMENT = static_cast<float>(fs["MAX_MEDIAN_DISPLACEMENT"]);
+    if (!fs["SCALE_MEDIAN_TOLERANCE"].empty())
+        SCALE_MEDIAN_TOLERANCE = static_cast<float>(fs["SCALE_MEDIAN_TOLERANCE"]);
     if (!fs["TERM_CRITERIA_COUNT"].empty())
         TERM_CRITERIA.maxCount = fs["TERM_CRITERIA_COUNT"];
     if (!fs["TERM_CRITERIA_EPS"].empty())
@@ -77,6 +104,8 @@ void tld::Params::read(const std::string& filename)
     // Cascade classifier parameters
     if (!fs["VARIANCE_FRACTION"].empty())
         VARIANCE_FRACTION = static_cast<float>(fs["VARIANCE_FRACTION"]);
+    if (!fs["FERN_SMOOTHING_SIGMA"].empty())
+        FERN_SMOOTHING_SIGMA = static_cast<float>(fs["FERN_SMOOTHING_SIGMA"]);
     if (!fs["OVERLAP_THRESHOLD"].empty())
         OVERLAP_THRESHOLD = static_cast<float>(fs["OVERLAP_THRESHOLD"]);
     if (!fs["NUM_FERNS"].empty())
@@ -93,22 +122,68 @@ void tld::Params::read(const std::string& filename)
         WIDTH_FRACTION = static_cast<float>(fs["WIDTH_FRACTION"]);
     if (!fs["HEIGHT_FRACTION"].empty())
         HEIGHT_FRACTION = static_cast<float>(fs["HEIGHT_FRACTION"]); 
+    if (!fs["PYRAMID_SCANNING"].empty())
+        PYRAMID_SCANNING = (static_cast<int>(fs["PYRAMID_SCANNING"]) != 0);
     if (!fs["MIN_AREA"].empty())
         MIN_AREA = static_cast<float>(fs["MIN_AREA"]); 
     if (!fs["THETA_PLUS"].empty())
         THETA_PLUS = static_cast<float>(fs["THETA_PLUS"]);
     if (!fs["THETA_MINUS"].empty())
         THETA_MINUS = static_cast<float>(fs["THETA_MINUS"]);
+    if (!fs["NUM_DETECTION_THREADS"].empty())
+        NUM_DETECTION_THREADS = fs["NUM_DETECTION_THREADS"];
+    if (!fs["EARLY_REJECTION"].empty())
+        EARLY_REJECTION = (static_cast<int>(fs["EARLY_REJECTION"]) != 0);
+    if (!fs["REORDER_FERNS"].empty())
+        REORDER_FERNS = (static_cast<int>(fs["REORDER_FERNS"]) != 0);
+    if (!fs["ROI_DETECTION"].empty())
+        ROI_DETECTION = (static_cast<int>(fs["ROI_DETECTION"]) != 0);
+    if (!fs["SEARCH_REGION_SCALE"].empty())
+        SEARCH_REGION_SCALE = static_cast<float>(fs["SEARCH_REGION_SCALE"]);
+    if (!fs["SEARCH_MOTION_FACTOR"].empty())
+        SEARCH_MOTION_FACTOR = static_cast<float>(fs["SEARCH_MOTION_FACTOR"]);
+    if (!fs["FULL_SCAN_INTERVAL"].empty())
+        FULL_SCAN_INTERVAL = fs["FULL_SCAN_INTERVAL"];
+    if (!fs["TEMPORAL_SKIPPING"].empty())
+        TEMPORAL_SKIPPING = (static_cast<int>(fs["TEMPORAL_SKIPPING"]) != 0);
+    if (!fs["NEGATIVE_STREAK_FRAMES"].empty())
+        NEGATIVE_STREAK_FRAMES = fs["NEGATIVE_STREAK_FRAMES"];
+    if (!fs["RECHECK_INTERVAL"].empty())
+        RECHECK_INTERVAL = fs["RECHECK_INTERVAL"];
+    if (!fs["FULL_SWEEP_INTERVAL"].empty())
+        FULL_SWEEP_INTERVAL = fs["FULL_SWEEP_INTERVAL"];
+    if (!fs["DETECTOR_SCHEDULING"].empty())
+        DETECTOR_SCHEDULING = (static_cast<int>(fs["DETECTOR_SCHEDULING"]) != 0);
+    if (!fs["MIN_DETECTION_INTERVAL"].empty())
+        MIN_DETECTION_INTERVAL = fs["MIN_DETECTION_INTERVAL"];
+    if (!fs["MAX_DETECTION_INTERVAL"].empty())
+        MAX_DETECTION_INTERVAL = fs["MAX_DETECTION_INTERVAL"];
+    if (!fs["SKIP_DETECTION_MARGIN"].empty())
+        SKIP_DETECTION_MARGIN = static_cast<float>(fs["SKIP_DETECTION_MARGIN"]);
 
     // Object model parameters
     if (!fs["RAND_REPLACEMENT"].empty())
         RAND_REPLACEMENT = (static_cast<int>(fs["RAND_REPLACEMENT"]) != 0);
     if (!fs["TEMPLATE_SIZE"].empty())
         TEMPLATE_SIZE = cv::Size(fs["TEMPLATE_SIZE"][0], fs["TEMPLATE_SIZE"][1]);
+    if (!fs["AREA_RESAMPLING"].empty())
+        AREA_RESAMPLING = (static_cast<int>(fs["AREA_RESAMPLING"]) != 0);
     if (!fs["INIT_OBJ_MODEL_SIZE"].empty())
         INIT_OBJ_MODEL_SIZE = static_cast<size_t>(static_cast<int>(fs["INIT_OBJ_MODEL_SIZE"]));
     if (!fs["MAX_OBJ_MODEL_SIZE"].empty())
         MAX_OBJ_MODEL_SIZE = static_cast<size_t>(static_cast<int>(fs["MAX_OBJ_MODEL_SIZE"]));
+    if (!fs["TEMPLATE_INDEX"].empty())
+        TEMPLATE_INDEX = (static_cast<int>(fs["TEMPLATE_INDEX"]) != 0);
+    if (!fs["TEMPLATE_INDEX_DIMENSIONS"].empty())
+        TEMPLATE_INDEX_DIMENSIONS = fs["TEMPLATE_INDEX_DIMENSIONS"];
+    if (!fs["TEMPLATE_INDEX_CANDIDATES"].empty())
+        TEMPLATE_INDEX_CANDIDATES = fs["TEMPLATE_INDEX_CANDIDATES"];
+    if (!fs["TEMPLATE_ADMISSION"].empty())
+        TEMPLATE_ADMISSION = (static_cast<int>(fs["TEMPLATE_ADMISSION"]) != 0);
+    if (!fs["ADMISSION_NCC_THRESHOLD"].empty())
+        ADMISSION_NCC_THRESHOLD = static_cast<float>(fs["ADMISSION_NCC_THRESHOLD"]);
+    if (!fs["ADMISSION_HASH_DISTANCE"].empty())
+        ADMISSION_HASH_DISTANCE = fs["ADMISSION_HASH_DISTANCE"];
 }
 
 
@@ -130,11 +205,13 @@ void tld::Params::write(const std::string& filename) const
     fs << "NCC_PATCH_SIZE" << NCC_PATCH_SIZE;
     fs << "FB_THRESHOLD" << FB_THRESHOLD;
     fs << "MAX_MEDIAN_DISPLACEMENT" << MAX_MEDIAN_DISPLACEMENT;
+    fs << "SCALE_MEDIAN_TOLERANCE" << SCALE_MEDIAN_TOLERANCE;
     fs << "TERM_CRITERIA_COUNT" << TERM_CRITERIA.maxCount;
     fs << "TERM_CRITERIA_EPS" << TERM_CRITERIA.epsilon;
 
     // Cascade classifier parameters
     fs << "VARIANCE_FRACTION" << VARIANCE_FRACTION;
+    fs << "FERN_SMOOTHING_SIGMA" << FERN_SMOOTHING_SIGMA;
     fs << "OVERLAP_THRESHOLD" << OVERLAP_THRESHOLD;
     fs << "NUM_FERNS" << NUM_FERNS;
     fs << "NUM_BINARY_FEATURES" << NUM_BINARY_FEATURES;
@@ -143,15 +220,38 @@ void tld::Params::write(const std::string& filename) const
     fs << "MAX_SCALE" << MAX_SCALE;
     fs << "WIDTH_FRACTION" << WIDTH_FRACTION;
     fs << "HEIGHT_FRACTION" << HEIGHT_FRACTION;
+    fs << "PYRAMID_SCANNING" << PYRAMID_SCANNING;
     fs << "MIN_AREA" << MIN_AREA;
     fs << "THETA_PLUS" << THETA_PLUS;
     fs << "THETA_MINUS" << THETA_MINUS;
+    fs << "NUM_DETECTION_THREADS" << NUM_DETECTION_THREADS;
+    fs << "EARLY_REJECTION" << EARLY_REJECTION;
+    fs << "REORDER_FERNS" << REORDER_FERNS;
+    fs << "ROI_DETECTION" << ROI_DETECTION;
+    fs << "SEARCH_REGION_SCALE" << SEARCH_REGION_SCALE;
+    fs << "SEARCH_MOTION_FACTOR" << SEARCH_MOTION_FACTOR;
+    fs << "FULL_SCAN_INTERVAL" << FULL_SCAN_INTERVAL;
+    fs << "TEMPORAL_SKIPPING" << TEMPORAL_SKIPPING;
+    fs << "NEGATIVE_STREAK_FRAMES" << NEGATIVE_STREAK_FRAMES;
+    fs << "RECHECK_INTERVAL" << RECHECK_INTERVAL;
+    fs << "FULL_SWEEP_INTERVAL" << FULL_SWEEP_INTERVAL;
+    fs << "DETECTOR_SCHEDULING" << DETECTOR_SCHEDULING;
+    fs << "MIN_DETECTION_INTERVAL" << MIN_DETECTION_INTERVAL;
+    fs << "MAX_DETECTION_INTERVAL" << MAX_DETECTION_INTERVAL;
+    fs << "SKIP_DETECTION_MARGIN" << SKIP_DETECTION_MARGIN;
 
     // Object model parameters
     fs << "RAND_REPLACEMENT" << RAND_REPLACEMENT;
     fs << "TEMPLATE_SIZE" << TEMPLATE_SIZE;
+    fs << "AREA_RESAMPLING" << AREA_RESAMPLING;
     fs << "INIT_OBJ_MODEL_SIZE" << static_cast<int>(INIT_OBJ_MODEL_SIZE);
     fs << "MAX_OBJ_MODEL_SIZE" << static_cast<int>(MAX_OBJ_MODEL_SIZE);
+    fs << "TEMPLATE_INDEX" << TEMPLATE_INDEX;
+    fs << "TEMPLATE_INDEX_DIMENSIONS" << TEMPLATE_INDEX_DIMENSIONS;
+    fs << "TEMPLATE_INDEX_CANDIDATES" << TEMPLATE_INDEX_CANDIDATES;
+    fs << "TEMPLATE_ADMISSION" << TEMPLATE_ADMISSION;
+    fs << "ADMISSION_NCC_THRESHOLD" << ADMISSION_NCC_THRESHOLD;
+    fs << "ADMISSION_HASH_DISTANCE" << ADMISSION_HASH_DISTANCE;
     
 }
 
@@ -172,12 +272,14 @@ void tld::Params::printParams() const
               << " NCC_PATCH_SIZE: " << NCC_PATCH_SIZE << std::endl
               << " FB_THRESHOLD: " << FB_THRESHOLD << std::endl
               << " MAX_MEDIAN_DISPLACEMENT: " << MAX_MEDIAN_DISPLACEMENT << std::endl
+              << " SCALE_MEDIAN_TOLERANCE: " << SCALE_MEDIAN_TOLERANCE << std::endl
               << " TERM_CRITERIA_COUNT: " << TERM_CRITERIA.maxCount << std::endl
               << " TERM_CRITERIA_EPS: " << TERM_CRITERIA.epsilon << std::endl;
 
     std::cout << "--------------------------------" << std::endl
               << "Cascade classifier parameters: " << std::endl
               << " VARIANCE_FRACTION: " << VARIANCE_FRACTION << std::endl
+              << " FERN_SMOOTHING_SIGMA: " << FERN_SMOOTHING_SIGMA << std::endl
               << " OVERLAP_THRESHOLD: " << OVERLAP_THRESHOLD << std::endl
               << " NUM_FERNS: " << NUM_FERNS << std::endl
               << " NUM_BINARY_FEATURES: " << NUM_BINARY_FEATURES << std::endl
@@ -186,16 +288,39 @@ void tld::Params::printParams() const
               << " MAX_SCALE: " << MAX_SCALE << std::endl
               << " WIDTH_FRACTION: " << WIDTH_FRACTION << std::endl
               << " HEIGHT_FRACTION: " << HEIGHT_FRACTION << std::endl
+              << " PYRAMID_SCANNING: " << PYRAMID_SCANNING << std::endl
               << " MIN_AREA: " << MIN_AREA << std::endl
               << " THETA_PLUS: " << THETA_PLUS << std::endl
-              << " THETA_MINUS: " << THETA_MINUS << std::endl;
+              << " THETA_MINUS: " << THETA_MINUS << std::endl
+              << " NUM_DETECTION_THREADS: " << NUM_DETECTION_THREADS << std::endl
+              << " EARLY_REJECTION: " << EARLY_REJECTION << std::endl
+              << " REORDER_FERNS: " << REORDER_FERNS << std::endl
+              << " ROI_DETECTION: " << ROI_DETECTION << std::endl
+              << " SEARCH_REGION_SCALE: " << SEARCH_REGION_SCALE << std::endl
+              << " SEARCH_MOTION_FACTOR: " << SEARCH_MOTION_FACTOR << std::endl
+              << " FULL_SCAN_INTERVAL: " << FULL_SCAN_INTERVAL << std::endl
+              << " TEMPORAL_SKIPPING: " << TEMPORAL_SKIPPING << std::endl
+              << " NEGATIVE_STREAK_FRAMES: " << NEGATIVE_STREAK_FRAMES << std::endl
+              << " RECHECK_INTERVAL: " << RECHECK_INTERVAL << std::endl
+              << " FULL_SWEEP_INTERVAL: " << FULL_SWEEP_INTERVAL << std::endl
+              << " DETECTOR_SCHEDULING: " << DETECTOR_SCHEDULING << std::endl
+              << " MIN_DETECTION_INTERVAL: " << MIN_DETECTION_INTERVAL << std::endl
+              << " MAX_DETECTION_INTERVAL: " << MAX_DETECTION_INTERVAL << std::endl
+              << " SKIP_DETECTION_MARGIN: " << SKIP_DETECTION_MARGIN << std::endl;
 
     std::cout << "--------------------------------" << std::endl
               << "Object model parameters: " << std::endl
               << " RAND_REPLACEMENT: " << RAND_REPLACEMENT << std::endl
               << " TEMPLATE_SIZE: " << TEMPLATE_SIZE << std::endl
+              << " AREA_RESAMPLING: " << AREA_RESAMPLING << std::endl
               << " INIT_OBJ_MODEL_SIZE: " << INIT_OBJ_MODEL_SIZE << std::endl
               << " MAX_OBJ_MODEL_SIZE: " << MAX_OBJ_MODEL_SIZE << std::endl
+              << " TEMPLATE_INDEX: " << TEMPLATE_INDEX << std::endl
+              << " TEMPLATE_INDEX_DIMENSIONS: " << TEMPLATE_INDEX_DIMENSIONS << std::endl
+              << " TEMPLATE_INDEX_CANDIDATES: " << TEMPLATE_INDEX_CANDIDATES << std::endl
+              << " TEMPLATE_ADMISSION: " << TEMPLATE_ADMISSION << std::endl
+              << " ADMISSION_NCC_THRESHOLD: " << ADMISSION_NCC_THRESHOLD << std::endl
+              << " ADMISSION_HASH_DISTANCE: " << ADMISSION_HASH_DISTANCE << std::endl
               << "--------------------------------" << std::endl
               << std::endl;
 }
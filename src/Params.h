@@ -30,10 +30,12 @@ namespace tld
         cv::Size NCC_PATCH_SIZE;         // patch size around a point for computing normalized cross-correlation
         float FB_THRESHOLD;              // threshold for the median forward-backward error
         float MAX_MEDIAN_DISPLACEMENT;   // used for detection of tracking failure
+        float SCALE_MEDIAN_TOLERANCE;    // rank tolerance of the sampled scale median (0 = exact over all point pairs)
         cv::TermCriteria TERM_CRITERIA;  // termination criteria for Lucas-Kanade optical flow
 
         // Cascade classifier parameters
         float VARIANCE_FRACTION;  // variance fraction of the initial patch (used for variance filter)
+        float FERN_SMOOTHING_SIGMA; // sigma of the smoothing of the frame for the fern features (0 = off)
         float OVERLAP_THRESHOLD;  // for non-maximal suppression
         int NUM_FERNS;            // number of ferns of ensemble classifier
         int NUM_BINARY_FEATURES;  // number of binary features (pixel comparisons) of each fern
@@ -42,14 +44,37 @@ namespace tld
         float MAX_SCALE;          // max sliding window scale
         float WIDTH_FRACTION;     // used for the computation of the sliding window step X
         float HEIGHT_FRACTION;    // used for the computation of the sliding window step Y
+        bool PYRAMID_SCANNING;    // scan a fixed-size window over an image pyramid instead of scaled windows
         float MIN_AREA;           // minimum area of the sliding window
         float THETA_PLUS;         // threshold for positive patch classification
         float THETA_MINUS;        // threshold for negative patch classification
+        int NUM_DETECTION_THREADS;  // number of worker threads of the sliding-window detection
+        bool EARLY_REJECTION;     // stop evaluating the ferns of a window once it cannot become positive
+        bool REORDER_FERNS;       // evaluate the most discriminative ferns first (used with EARLY_REJECTION)
+        bool ROI_DETECTION;       // scan only a search region around the last valid bbox
+        float SEARCH_REGION_SCALE; // size of the search region relative to the last valid bbox
+        float SEARCH_MOTION_FACTOR; // margin of the search region in multiples of the recent motion
+        int FULL_SCAN_INTERVAL;   // number of frames between the full-frame scans in ROI_DETECTION mode
+        bool TEMPORAL_SKIPPING;   // re-check persistently negative windows only every RECHECK_INTERVAL frames
+        int NEGATIVE_STREAK_FRAMES; // frames a window has to be rejected in a row to be re-checked less often
+        int RECHECK_INTERVAL;     // frames between the re-checks of a persistently negative window
+        int FULL_SWEEP_INTERVAL;  // frames between the sweeps over all the windows in TEMPORAL_SKIPPING mode
+        bool DETECTOR_SCHEDULING; // skip the detector while the track is stable
+        int MIN_DETECTION_INTERVAL; // min number of frames between the detector runs of a stable track
+        int MAX_DETECTION_INTERVAL; // max number of frames between the detector runs of a stable track
+        float SKIP_DETECTION_MARGIN; // a track is stable if its similarity exceeds THETA_PLUS by this margin
 
         // Object model parameters
         bool RAND_REPLACEMENT;
         cv::Size TEMPLATE_SIZE; // object model template size
+        bool AREA_RESAMPLING;     // resample the patches to TEMPLATE_SIZE by area averaging instead of bicubic resizing
         size_t INIT_OBJ_MODEL_SIZE;
         size_t MAX_OBJ_MODEL_SIZE;
+        bool TEMPLATE_INDEX;      // index the templates for the nearest-neighbour search (for large models)
+        int TEMPLATE_INDEX_DIMENSIONS; // dimensions of the projection of the templates in the index
+        int TEMPLATE_INDEX_CANDIDATES; // templates re-ranked per search, 0 for the exact search
+        bool TEMPLATE_ADMISSION;  // reject redundant templates and evict the most redundant one from a full model
+        float ADMISSION_NCC_THRESHOLD; // a template is redundant if its NCC to another one exceeds this threshold
+        int ADMISSION_HASH_DISTANCE; // max Hamming distance of the 64-bit signatures of the templates compared by NCC
     };
 } // namespace tld
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include <algorithm>  // std::min, std::max, std::copy
+#include <cstdint>
+#include <utility>    // std::swap
+#include "PatchNormalizer.h"
+#include "Utils.h"
+
+
+tld::PatchNormalizer::PatchNormalizer(const cv::Size& templateSize, bool areaResampling)
+{
+    CV_Assert(!templateSize.empty());
+
+    this->templateSize = templateSize;
+    this->areaResampling = areaResampling;
+}
+
+
+/**
+ * Sets the frame the bboxes refer to and drops the cached patches and the integral image of the previous frame.
+ */
+void tld::PatchNormalizer::setFrame(const cv::Mat& frame)
+{
+    CV_Assert(frame.type() == CV_8UC1);
+
+    this->frame = frame;
+    this->hasIntegral = false;
+    this->entries.clear();
+    this->cache.clear();
+    this->numCandidates = 0;
+    this->candidateCache.clear();
+}
+
+
+/**
+ * Returns the integral images of the whole frame, computed on the first request of the frame
+ * (the buffers are reused across frames).
+ */
+const tld::utils::IntegralImage& tld::PatchNormalizer::frameIntegral()
+{
+    if (!this->hasIntegral || this->integral.origin != cv::Point(0, 0)
+        || this->integral.cols != this->frame.cols + 1 || this->integral.rows != this->frame.rows + 1)
+    {
+        tld::utils::computeIntegralImage2(this->frame, this->integral);
+        this->hasIntegral = true;
+    }
+    return this->integral;
+}
+
+
+/**
+ * Hands over the integral images the detector computed for the current frame, unless the frame
+ * already has one. Their top-left part (from their origin) has to be the frame, as for the scanned
+ * images of ScanningGrid, whose first level is the frame itself. The bboxes the integral images
+ * do not cover are resampled with frameIntegral.
+ */
+void tld::PatchNormalizer::setIntegral(tld::utils::IntegralImage&& integral)
+{
+    if (!this->hasIntegral)
+    {
+        std::swap(this->integral, integral);
+        this->hasIntegral = true;
+    }
+}
+
+
+/**
+ * Returns the bbox resampled to templateSize (shared with the cache, not to be modified).
+ */
+cv::Mat tld::PatchNormalizer::patch(const BBox& bbox)
+{
+    return this->entry(bbox).patch;
+}
+
+
+/**
+ * Returns the normalized vector of the bbox as a single row (shared with the cache, not to be modified).
+ */
+cv::Mat tld::PatchNormalizer::vector(const BBox& bbox)
+{
+    return this->entry(bbox).vector;
+}
+
+
+/**
+ * Writes the normalized vector of the bbox (templateSize.area() values) to vector.
+ * Unlike vector, only the resampled patch is kept, in a pool whose buffers are reused across
+ * frames, so normalizing many bboxes allocates nothing once the pool has grown. A later patch
+ * or vector of the bbox is taken from the pool.
+ */
+void tld::PatchNormalizer::normalize(const BBox& bbox, float* vector)
+{
+    auto it = this->cache.find(bbox);
+    if (it != this->cache.end())
+    {
+        const cv::Mat& cachedVector = this->entries[it->second].vector;
+        std::copy(cachedVector.ptr<float>(0), cachedVector.ptr<float>(0) + cachedVector.cols, vector);
+        return;
+    }
+
+    auto candidate = this->candidateCache.find(bbox);
+    if (candidate != this->candidateCache.end())
+    {
+        tld::utils::normalizePatch(this->candidatePatches[candidate->second], vector);
+        return;
+    }
+
+    if (this->numCandidates == this->candidatePatches.size())
+    {
+        this->candidatePatches.emplace_back();
+    }
+    cv::Mat& patch = this->candidatePatches[this->numCandidates];
+    this->resample(bbox, patch);
+    tld::utils::normalizePatch(patch, vector);
+    this->candidateCache.emplace(bbox, this->numCandidates++);
+}
+
+
+const tld::PatchNormalizer::Entry& tld::PatchNormalizer::entry(const BBox& bbox)
+{
+    auto it = this->cache.find(bbox);
+    if (it != this->cache.end())
+    {
+        return this->entries[it->second];
+    }
+
+    // The pooled patches are overwritten on the next frame, the entries get their own copy
+    Entry newEntry;
+    auto candidate = this->candidateCache.find(bbox);
+    if (candidate != this->candidateCache.end())
+    {
+        newEntry.patch = this->candidatePatches[candidate->second].clone();
+    }
+    else
+    {
+        this->resample(bbox, newEntry.patch);
+    }
+    newEntry.vector = cv::Mat(1, this->templateSize.area(), CV_32F);
+    tld::utils::normalizePatch(newEntry.patch, newEntry.vector.ptr<float>(0));
+
+    this->cache.emplace(bbox, this->entries.size());
+    this->entries.push_back(newEntry);
+
+    return this->entries.back();
+}
+
+
+/**
+ * Resamples the bbox (clipped to the frame) to a templateSize patch (the allocation of patch is reused).
+ */
+void tld::PatchNormalizer::resample(const BBox& bbox, cv::Mat& patch)
+{
+    if (this->areaResampling)
+    {
+        this->resampleArea(bbox, patch);
+    }
+    else
+    {
+        const BBox clippedBbox = bbox & BBox(0, 0, this->frame.cols, this->frame.rows);
+        cv::resize(this->frame(clippedBbox), patch, this->templateSize, 0, 0, cv::INTER_CUBIC);
+    }
+}
+
+
+/**
+ * Returns true if the bilinear samples of the integral image of resampleArea
+ * at the corners of the frame area [x0, x1] x [y0, y1] lie in the given integral image.
+ */
+static bool coversArea(const tld::utils::IntegralImage& integral, const cv::Size& frameSize,
+                       float x0, float y0, float x1, float y1)
+{
+    const int firstX = static_cast<int>(x0);
+    const int firstY = static_cast<int>(y0);
+    const int lastX = std::min(static_cast<int>(x1), frameSize.width - 1) + 1;
+    const int lastY = std::min(static_cast<int>(y1), frameSize.height - 1) + 1;
+    return firstX >= integral.origin.x && firstY >= integral.origin.y
+           && lastX < integral.origin.x + integral.cols && lastY < integral.origin.y + integral.rows;
+}
+
+
+/**
+ * Averages the frame over the cells of a templateSize grid laid over the bbox (clipped to the frame).
+ * The integral image of a piecewise-constant image is bilinear within every pixel, so its bilinear
+ * interpolation at the cell corners gives the exact sums over the cells, also for fractional corners.
+ * The sums are taken from the integral image of the frame handed over by the detector if it covers
+ * the bbox, otherwise from frameIntegral.
+ */
+void tld::PatchNormalizer::resampleArea(const BBox& bbox, cv::Mat& patch)
+{
+    const int width = this->templateSize.width;
+    const int height = this->templateSize.height;
+    const float x0 = std::min(std::max(bbox.x, 0.0f), static_cast<float>(this->frame.cols));
+    const float y0 = std::min(std::max(bbox.y, 0.0f), static_cast<float>(this->frame.rows));
+    const float x1 = std::min(std::max(bbox.x + bbox.width, 0.0f), static_cast<float>(this->frame.cols));
+    const float y1 = std::min(std::max(bbox.y + bbox.height, 0.0f), static_cast<float>(this->frame.rows));
+
+    patch.create(this->templateSize, CV_8UC1);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        patch.setTo(0);
+        return;
+    }
+
+    if (!this->hasIntegral || !coversArea(this->integral, this->frame.size(), x0, y0, x1, y1))
+    {
+        this->frameIntegral();
+    }
+    const tld::utils::IntegralImage& integral = this->integral;
+
+    // Integral image at the (height + 1) x (width + 1) cell corners
+    auto sample = [this, &integral](float y, float x)
+    {
+        const int iy = std::min(static_cast<int>(y), this->frame.rows - 1);
+        const int ix = std::min(static_cast<int>(x), this->frame.cols - 1);
+        const double ty = y - iy;
+        const double tx = x - ix;
+        const std::int64_t* const row0 = &integral.sum[(iy - integral.origin.y) * integral.cols + (ix - integral.origin.x)];
+        const std::int64_t* const row1 = row0 + integral.cols;
+        return (1.0 - ty) * ((1.0 - tx) * row0[0] + tx * row0[1])
+               + ty * ((1.0 - tx) * row1[0] + tx * row1[1]);
+    };
+    const float cellWidth = (x1 - x0) / width;
+    const float cellHeight = (y1 - y0) / height;
+    std::vector<double>& corners = this->corners;
+    corners.resize((height + 1) * (width + 1));
+    for (int i = 0; i <= height; ++i)
+    {
+        const float y = (i == height) ? y1 : y0 + i * cellHeight;
+        for (int j = 0; j <= width; ++j)
+        {
+            const float x = (j == width) ? x1 : x0 + j * cellWidth;
+            corners[i * (width + 1) + j] = sample(y, x);
+        }
+    }
+
+    const double cellArea = static_cast<double>(cellWidth) * cellHeight;
+    for (int i = 0; i < height; ++i)
+    {
+        const double* const top = &corners[i * (width + 1)];
+        const double* const bottom = top + (width + 1);
+        uchar* const patchRowPtr = patch.ptr<uchar>(i);
+        for (int j = 0; j < width; ++j)
+        {
+            const double sum = bottom[j + 1] - bottom[j] - top[j + 1] + top[j];
+            patchRowPtr[j] = cv::saturate_cast<uchar>(sum / cellArea);
+        }
+    }
+}
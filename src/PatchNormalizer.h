@@ -0,0 +1,86 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "Utils.h"
+
+
+using BBox = cv::Rect2f;
+
+namespace tld
+{
+/**
+ * Resamples the bboxes of the current frame to templateSize patches and normalizes them
+ * (see tld::utils::normalizePatch). The patches are either resized bicubically or, if
+ * areaResampling is set, averaged over the cells of a templateSize grid laid over the bbox
+ * using the integral image of the frame. The integral image is computed once per frame,
+ * either on the first request (see frameIntegral) or by the detector (see setIntegral).
+ * The results of patch and vector are cached per bbox until the next frame is set, so the
+ * template matching, the fusion and the learning of a frame never resample the same bbox twice.
+ * The many candidates of the detector are normalized with normalize, which only keeps their
+ * patches in a pool reused across frames, so that the learning of the frame takes its
+ * negatives from them without resampling.
+ */
+class PatchNormalizer
+{
+public:
+    PatchNormalizer() = default;
+    PatchNormalizer(const cv::Size& templateSize, bool areaResampling);
+
+    void setFrame(const cv::Mat& frame);
+
+    const tld::utils::IntegralImage& frameIntegral();
+
+    void setIntegral(tld::utils::IntegralImage&& integral);
+
+    cv::Mat patch(const BBox& bbox);
+
+    cv::Mat vector(const BBox& bbox);
+
+    void normalize(const BBox& bbox, float* vector);
+
+private:
+    struct Entry
+    {
+        cv::Mat patch;   // CV_8UC1, templateSize
+        cv::Mat vector;  // CV_32F, 1 x templateSize.area()
+    };
+
+    struct BBoxHash
+    {
+        std::size_t operator()(const BBox& bbox) const
+        {
+            std::size_t seed = 0;
+            for (float value : {bbox.x, bbox.y, bbox.width, bbox.height})
+            {
+                seed ^= std::hash<float>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+
+    cv::Size templateSize;
+    bool areaResampling = false;
+
+    cv::Mat frame;
+    // Integral image of the frame, or of an image whose top-left part is the frame (see setIntegral)
+    tld::utils::IntegralImage integral;
+    bool hasIntegral = false;
+    std::vector<Entry> entries;
+    std::unordered_map<BBox, std::size_t, BBoxHash> cache;  // bbox -> index of its entry
+    std::vector<cv::Mat> candidatePatches;  // resampled patches of normalize, reused across frames
+    std::size_t numCandidates = 0;
+    std::unordered_map<BBox, std::size_t, BBoxHash> candidateCache;  // bbox -> index of its candidate patch
+    std::vector<double> corners;  // integral image at the cell corners of resampleArea, reused
+
+    const Entry& entry(const BBox& bbox);
+
+    void resample(const BBox& bbox, cv::Mat& patch);
+
+    void resampleArea(const BBox& bbox, cv::Mat& patch);
+};
+
+} // namespace tld
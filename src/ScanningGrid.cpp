@@ -0,0 +1,293 @@
+#include <algorithm>  // std::upper_bound, std::max, std::min
+#include <cmath>      // std::floor, std::ceil
+#include <cstdint>
+#include <limits>
+#include "ScanningGrid.h"
+
+
+/**
+ * Constructor of ScanningGrid.
+ * The scales are MIN_SCALE + i * SCALE_STEP (up to MAX_SCALE) of the initial bbox size,
+ * and the strides are fractions (WIDTH_FRACTION, HEIGHT_FRACTION) of the initial bbox size.
+ * With PYRAMID_SCANNING, the frame is downscaled by each scale relative to the smallest one
+ * and the strides are downscaled alike, so that they stay the same in frame pixels.
+ */
+tld::ScanningGrid::ScanningGrid(const cv::Size& frameSize, const BBox& initialBbox, const Params* params)
+{
+    CV_Assert(params->SCALE_STEP > 0.0f && !initialBbox.empty());
+
+    this->frameSize = frameSize;
+    this->imageSize = frameSize;
+    this->isPyramid = params->PYRAMID_SCANNING;
+
+    const float strideX = std::max(params->WIDTH_FRACTION * initialBbox.width, 1.0f);
+    const float strideY = std::max(params->HEIGHT_FRACTION * initialBbox.height, 1.0f);
+
+    cv::Size baseSize;  // window size of the smallest scale (PYRAMID_SCANNING)
+    float baseScale = 0.0f;
+    int levelY = 0;
+
+    // The small epsilon makes MAX_SCALE inclusive despite the rounding errors of the step
+    const int numScales = static_cast<int>(std::floor((params->MAX_SCALE - params->MIN_SCALE) / params->SCALE_STEP + 1e-4f)) + 1;
+    for (int i = 0; i < numScales; ++i)
+    {
+        const float s = params->MIN_SCALE + i * params->SCALE_STEP;
+        const int w = cvRound(s * initialBbox.width);
+        const int h = cvRound(s * initialBbox.height);
+        if (w * h < params->MIN_AREA || w <= 0 || h <= 0 || w > frameSize.width || h > frameSize.height)
+        {
+            continue;
+        }
+
+        GridScale scale;
+        if (this->isPyramid)
+        {
+            if (baseSize.empty())
+            {
+                baseSize = cv::Size(w, h);
+                baseScale = s;
+            }
+            scale.frameScale = s / baseScale;
+            scale.windowSize = baseSize;
+            // Rounded down, so that the windows of the level mapped back by frameScale stay inside the frame
+            scale.level = cv::Rect(0, levelY,
+                                   cvFloor(frameSize.width / scale.frameScale),
+                                   cvFloor(frameSize.height / scale.frameScale));
+            if (baseSize.width > scale.level.width || baseSize.height > scale.level.height)
+            {
+                continue;
+            }
+            levelY += scale.level.height;
+        }
+        else
+        {
+            scale.frameScale = 1.0f;
+            scale.windowSize = cv::Size(w, h);
+            scale.level = cv::Rect(cv::Point(0, 0), frameSize);
+        }
+
+        scale.strideX = std::max(cvRound(strideX / scale.frameScale), 1);
+        scale.strideY = std::max(cvRound(strideY / scale.frameScale), 1);
+        scale.numCols = (scale.level.width - scale.windowSize.width) / scale.strideX + 1;
+        scale.numRows = (scale.level.height - scale.windowSize.height) / scale.strideY + 1;
+        scale.firstIndex = this->numWindows;
+
+        this->scales.push_back(scale);
+        this->numWindows += scale.numCols * scale.numRows;
+    }
+
+    if (this->isPyramid)
+    {
+        this->imageSize = cv::Size(frameSize.width, levelY);
+    }
+}
+
+
+/**
+ * Geometry of the grid in a model file, followed by a GridScaleRecord per scale.
+ */
+struct GridInfo
+{
+    std::int32_t frameWidth;
+    std::int32_t frameHeight;
+    std::int32_t imageWidth;
+    std::int32_t imageHeight;
+    std::int32_t isPyramid;
+    std::int32_t numScales;
+};
+
+
+struct GridScaleRecord
+{
+    std::int32_t windowWidth;
+    std::int32_t windowHeight;
+    std::int32_t strideX;
+    std::int32_t strideY;
+    std::int32_t numCols;
+    std::int32_t numRows;
+    std::int32_t firstIndex;
+    std::int32_t levelX;
+    std::int32_t levelY;
+    std::int32_t levelWidth;
+    std::int32_t levelHeight;
+    float frameScale;
+};
+
+
+/**
+ * Constructor of ScanningGrid from a model file (see save). The geometry is validated, so that
+ * the windows of every scale lie in their level and the levels in the scanned image.
+ */
+tld::ScanningGrid::ScanningGrid(const ModelFile& file)
+{
+    const GridInfo info = file.value<GridInfo>(GRID_INFO);
+    CV_Assert(info.numScales > 0 && info.frameWidth > 0 && info.frameHeight > 0
+              && info.imageWidth >= info.frameWidth && info.imageHeight >= info.frameHeight);
+
+    this->frameSize = cv::Size(info.frameWidth, info.frameHeight);
+    this->imageSize = cv::Size(info.imageWidth, info.imageHeight);
+    this->isPyramid = (info.isPyramid != 0);
+
+    const GridScaleRecord* const records = file.section<GridScaleRecord>(GRID_SCALES, info.numScales);
+    for (int s = 0; s < info.numScales; ++s)
+    {
+        const GridScaleRecord& record = records[s];
+        GridScale scale;
+        scale.windowSize = cv::Size(record.windowWidth, record.windowHeight);
+        scale.strideX = record.strideX;
+        scale.strideY = record.strideY;
+        scale.numCols = record.numCols;
+        scale.numRows = record.numRows;
+        scale.firstIndex = record.firstIndex;
+        scale.level = cv::Rect(record.levelX, record.levelY, record.levelWidth, record.levelHeight);
+        scale.frameScale = record.frameScale;
+        CV_Assert(scale.firstIndex == this->numWindows && scale.strideX > 0 && scale.strideY > 0
+                  && scale.numCols > 0 && scale.numRows > 0 && !scale.windowSize.empty() && scale.frameScale > 0.0f
+                  && (cv::Rect(cv::Point(0, 0), this->imageSize) & scale.level) == scale.level);
+        CV_Assert(static_cast<std::int64_t>(scale.numCols - 1) * scale.strideX + scale.windowSize.width <= scale.level.width
+                  && static_cast<std::int64_t>(scale.numRows - 1) * scale.strideY + scale.windowSize.height <= scale.level.height);
+        CV_Assert(static_cast<std::int64_t>(this->numWindows) + static_cast<std::int64_t>(scale.numCols) * scale.numRows
+                  <= std::numeric_limits<int>::max());
+
+        this->scales.push_back(scale);
+        this->numWindows += scale.numCols * scale.numRows;
+    }
+}
+
+
+/**
+ * Adds the geometry of the grid to the model file.
+ */
+void tld::ScanningGrid::save(ModelWriter& writer) const
+{
+    const GridInfo info = {this->frameSize.width, this->frameSize.height,
+                           this->imageSize.width, this->imageSize.height,
+                           this->isPyramid ? 1 : 0, static_cast<std::int32_t>(this->scales.size())};
+    std::vector<GridScaleRecord> records;
+    for (const GridScale& scale : this->scales)
+    {
+        records.push_back({scale.windowSize.width, scale.windowSize.height, scale.strideX, scale.strideY,
+                           scale.numCols, scale.numRows, scale.firstIndex,
+                           scale.level.x, scale.level.y, scale.level.width, scale.level.height, scale.frameScale});
+    }
+    writer.addSection(GRID_INFO, info);
+    writer.addSection(GRID_SCALES, records.data(), records.size() * sizeof(GridScaleRecord));
+}
+
+
+/**
+ * Builds the image scanned by the windows from the frame: the frame itself, or the levels
+ * of the pyramid stacked on top of each other (the allocation of image is reused).
+ */
+void tld::ScanningGrid::buildImage(const cv::Mat& frame, cv::Mat& image) const
+{
+    if (!this->isPyramid)
+    {
+        image = frame;
+        return;
+    }
+
+    CV_Assert(frame.size() == this->frameSize);
+    if (image.size() != this->imageSize || image.type() != frame.type() || image.data == frame.data)
+    {
+        // The columns right of the levels are never scanned, but are summed by the integral images
+        image = cv::Mat::zeros(this->imageSize, frame.type());
+    }
+    for (const GridScale& scale : this->scales)
+    {
+        cv::Mat level = image(scale.level);
+        cv::resize(frame, level, scale.level.size(), 0, 0, cv::INTER_AREA);
+    }
+}
+
+
+/**
+ * Returns the total number of windows.
+ */
+int tld::ScanningGrid::size() const
+{
+    return this->numWindows;
+}
+
+
+/**
+ * Returns the index of the scale of the window with the given flat index.
+ */
+int tld::ScanningGrid::scaleIndex(int index) const
+{
+    auto it = std::upper_bound(this->scales.begin(), this->scales.end(), index,
+                               [](int i, const GridScale& scale) { return i < scale.firstIndex; });
+    return static_cast<int>(it - this->scales.begin()) - 1;
+}
+
+
+/**
+ * Returns the window with the given flat index.
+ */
+tld::Subwindow tld::ScanningGrid::window(int index) const
+{
+    const int s = this->scaleIndex(index);
+    const GridScale& scale = this->scales[s];
+    const int offset = index - scale.firstIndex;
+    return this->window(s, offset / scale.numCols, offset % scale.numCols);
+}
+
+
+/**
+ * Returns the window at the given row and column of the given scale.
+ */
+tld::Subwindow tld::ScanningGrid::window(int scaleIndex, int row, int col) const
+{
+    const GridScale& scale = this->scales[scaleIndex];
+    return {scale.level.x + col * scale.strideX, scale.level.y + row * scale.strideY, scaleIndex};
+}
+
+
+/**
+ * Returns the bbox covered by the given window in frame coordinates (clipped to the frame,
+ * which the windows at the right or bottom edge of a level may exceed by the rounding errors).
+ */
+BBox tld::ScanningGrid::bbox(const Subwindow& window) const
+{
+    const GridScale& scale = this->scales[window.scaleIndex];
+    const float f = scale.frameScale;
+    const BBox bbox((window.x - scale.level.x) * f, (window.y - scale.level.y) * f,
+                    scale.windowSize.width * f, scale.windowSize.height * f);
+    return bbox & BBox(0.0f, 0.0f, static_cast<float>(this->frameSize.width), static_cast<float>(this->frameSize.height));
+}
+
+
+BBox tld::ScanningGrid::bbox(int index) const
+{
+    return this->bbox(this->window(index));
+}
+
+
+/**
+ * Returns the columns (x, width) and the rows (y, height) of the windows of the given scale
+ * whose centers lie inside the given region of the frame. An empty region selects all the windows.
+ */
+cv::Rect tld::ScanningGrid::windowRange(int scaleIndex, const cv::Rect& region) const
+{
+    const GridScale& scale = this->scales[scaleIndex];
+    if (region.empty())
+    {
+        return cv::Rect(0, 0, scale.numCols, scale.numRows);
+    }
+
+    // The center of the window (row, col) is at (col * strideX + width / 2, row * strideY + height / 2)
+    // in the level, i.e. frameScale times that in the frame
+    const float x0 = region.x / scale.frameScale - 0.5f * scale.windowSize.width;
+    const float y0 = region.y / scale.frameScale - 0.5f * scale.windowSize.height;
+    const float x1 = (region.x + region.width) / scale.frameScale - 0.5f * scale.windowSize.width;
+    const float y1 = (region.y + region.height) / scale.frameScale - 0.5f * scale.windowSize.height;
+    const int firstCol = std::max(0, static_cast<int>(std::ceil(x0 / scale.strideX)));
+    const int firstRow = std::max(0, static_cast<int>(std::ceil(y0 / scale.strideY)));
+    const int lastCol = std::min(scale.numCols, static_cast<int>(std::ceil(x1 / scale.strideX))) - 1;
+    const int lastRow = std::min(scale.numRows, static_cast<int>(std::ceil(y1 / scale.strideY))) - 1;
+    if (lastCol < firstCol || lastRow < firstRow)
+    {
+        return cv::Rect();
+    }
+    return cv::Rect(firstCol, firstRow, lastCol - firstCol + 1, lastRow - firstRow + 1);
+}
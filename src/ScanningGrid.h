@@ -0,0 +1,88 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "ModelFile.h"
+#include "Params.h"
+
+
+using BBox = cv::Rect2f;
+
+namespace tld
+{
+/**
+ * Compact record of a single sliding window (subwindow) of the detector.
+ */
+struct Subwindow
+{
+    int x;           // top-left corner of the window in the scanned image
+    int y;
+    int scaleIndex;  // index into ScanningGrid::scales
+};
+
+
+/**
+ * Geometry of the sliding windows of a single scale.
+ * The window coordinates are in the scanned image (see ScanningGrid) and multiplied by
+ * frameScale relative to level.tl() they give the frame coordinates.
+ */
+struct GridScale
+{
+    cv::Size windowSize;
+    int strideX;
+    int strideY;
+    int numCols;
+    int numRows;
+    int firstIndex;    // flat index of the first window of the scale
+    cv::Rect level;    // area of the scanned image the windows lie in
+    float frameScale;  // size of a pixel of the level in frame pixels
+};
+
+
+/**
+ * Integer grid of the sliding windows of all the scales.
+ * The windows are addressed either by (scale, row, col) or by a flat index,
+ * scale by scale in row-major order.
+ *
+ * By default, the windows of all the scales are scaled copies of the initial bbox scanned over
+ * the frame itself. With PYRAMID_SCANNING, all the windows have the size of the smallest scale and
+ * each scale is scanned over its own level of an image pyramid. The levels are stacked on top
+ * of each other in a single image, so that all the scales share the row step of the image
+ * (and thus the fern offsets and the integral-image corner offsets).
+ */
+class ScanningGrid
+{
+public:
+    cv::Size frameSize;
+    cv::Size imageSize;  // size of the scanned image (the frame or the stacked pyramid)
+    bool isPyramid = false;
+    std::vector<GridScale> scales;
+
+public:
+    ScanningGrid() = default;
+    ScanningGrid(const cv::Size& frameSize, const BBox& initialBbox, const Params* params);
+    ScanningGrid(const ModelFile& file);
+
+    void save(ModelWriter& writer) const;
+
+    int size() const;
+
+    int scaleIndex(int index) const;
+
+    Subwindow window(int index) const;
+
+    Subwindow window(int scaleIndex, int row, int col) const;
+
+    BBox bbox(const Subwindow& window) const;
+
+    BBox bbox(int index) const;
+
+    cv::Rect windowRange(int scaleIndex, const cv::Rect& region) const;
+
+    void buildImage(const cv::Mat& frame, cv::Mat& image) const;
+
+private:
+    int numWindows = 0;
+};
+
+} // namespace tld
@@ -1,20 +1,24 @@
 #include "TLD.h"
+#include "ModelFile.h"
 #include "Utils.h"
 
 
+/**
+ * State of TLD in a model file, besides the object model and the detector.
+ */
+struct TLDState
+{
+    float lastValidBbox[4];
+    float recentMotion[2];
+};
+
+
 tld::TLD::TLD(const cv::Mat &initialFrame,
               const BBox &initialBbox)
 {
-    // Initialize parameters
-    //this->params = Params();
-    //this->params.write("../params.yaml");
-    this->params.read("../params.yaml");
-    this->params.printParams();
+    double timer = static_cast<double>(cv::getTickCount());
 
-    // Random number generator
-    this->rng = tld::utils::Random(params.RNG_SEED);
-
-    this->isValidPrevBbox = false;
+    this->initialize();
 
     // Initialize the object model
     this->objectModel = ObjectModel(initialFrame, initialBbox, &params, &rng);
@@ -23,10 +27,93 @@ tld::TLD::TLD(const cv::Mat &initialFrame,
     this->tracker = MedianFlowTracker(initialFrame, initialBbox, &params, &rng);
 
     // Initialize the detector
-    this->detector = CascadeClassifier(initialFrame, initialBbox, objectModel, &params, &rng);
+    this->detector = CascadeClassifier(initialFrame, initialBbox, &objectModel, &params, &rng);
 
     // Run the learn method for the initial frame and bbox
-    this->learn(initialFrame, initialBbox);
+    // (the detection provides the per-window results needed by the learning)
+    this->detect(initialFrame);
+    this->learn(initialBbox);
+
+    this->startupTime = 1000.0 * (cv::getTickCount() - timer) / cv::getTickFrequency();
+    std::cout << "TLD initialized in " << this->startupTime << " ms ("
+              << this->detector.grid.size() << " subwindows)." << std::endl;
+}
+
+
+/**
+ * Constructor of TLD resuming from a model file written by save: the object model and
+ * the detector are used as learned, without any learning on the initial frame.
+ * The tracker starts from initialBbox or, if it is empty, from the last valid bbox of the saved session.
+ */
+tld::TLD::TLD(const cv::Mat &initialFrame,
+              const BBox &initialBbox,
+              const std::string &modelFilename)
+{
+    double timer = static_cast<double>(cv::getTickCount());
+
+    this->initialize();
+
+    this->modelFile = std::make_shared<ModelFile>(modelFilename);
+    this->objectModel = ObjectModel(*this->modelFile, &params, &rng);
+    this->detector = CascadeClassifier(*this->modelFile, initialFrame, &objectModel, &params);
+
+    const TLDState state = this->modelFile->value<TLDState>(TLD_STATE);
+    const BBox savedBbox(state.lastValidBbox[0], state.lastValidBbox[1], state.lastValidBbox[2], state.lastValidBbox[3]);
+    const BBox trackerBbox = initialBbox.empty() ? savedBbox : initialBbox;
+    if (trackerBbox.empty())
+    {
+        CV_Error(cv::Error::StsError, "The model file " + modelFilename + " has no valid bbox, an initial bbox is needed");
+    }
+    this->tracker = MedianFlowTracker(initialFrame, trackerBbox, &params, &rng);
+
+    // The search region of the detector (ROI_DETECTION) resumes from the bbox the tracker starts from
+    // and the saved motion, the motion is updated from the first valid bbox on
+    this->lastValidBbox = trackerBbox;
+    this->recentMotion = cv::Point2f(state.recentMotion[0], state.recentMotion[1]);
+
+    this->startupTime = 1000.0 * (cv::getTickCount() - timer) / cv::getTickFrequency();
+    std::cout << "TLD loaded from " << modelFilename << " in " << this->startupTime << " ms ("
+              << this->detector.grid.size() << " subwindows)." << std::endl;
+}
+
+
+/**
+ * Writes the learned state (object model, detector and the last valid bbox) to a model file,
+ * see ModelWriter for the layout.
+ */
+void tld::TLD::save(const std::string &modelFilename) const
+{
+    const BBox& bbox = this->lastValidBbox;
+    const TLDState state = {{bbox.x, bbox.y, bbox.width, bbox.height}, {this->recentMotion.x, this->recentMotion.y}};
+
+    ModelWriter writer;
+    writer.addSection(TLD_STATE, state);
+    this->objectModel.save(writer);
+    this->detector.save(writer);
+    writer.write(modelFilename);
+}
+
+
+/**
+ * Reads the parameters and resets the state shared by the constructors.
+ */
+void tld::TLD::initialize()
+{
+    // Initialize parameters
+    //this->params = Params();
+    //this->params.write("../params.yaml");
+    this->params.read("../params.yaml");
+    this->params.printParams();
+
+    // Random number generator
+    this->rng = tld::utils::Random(params.RNG_SEED);
+
+    this->isValidPrevBbox = false;
+    this->framesSinceFullScan = 0;
+    this->detectionInterval = params.MIN_DETECTION_INTERVAL;
+    this->framesSinceDetection = 0;
+    this->numDetectorRuns = 0;
+    this->numDetectorSkips = 0;
 }
 
 
@@ -35,19 +122,42 @@ void tld::TLD::run(const cv::Mat &frame,
                    std::vector<BBox> &detectedBboxes,
                    BBox &fusedBbox)
 {
+        // The resampled patches of the frame are shared by the detection, the fusion and the learning
+        this->detector.setFrame(frame);
+
         // TRACKING
         trackedBbox = this->track(frame);
+        float trackedConfidence = 0.0f;
+        if (!trackedBbox.empty())
+        {
+            trackedConfidence = this->detector.templateMatching(trackedBbox);
+        }
 
         // DETECTION
-        detectedBboxes = this->detect(frame);
+        bool isDetectorRun = this->scheduleDetector(trackedBbox, trackedConfidence);
+        if (isDetectorRun)
+        {
+            detectedBboxes = this->detect(frame, this->searchRegion(frame.size()));
+        }
+        else
+        {
+            detectedBboxes.clear();
+        }
 
         // FUSION
-        fusedBbox = this->fuse(frame, trackedBbox, detectedBboxes);
+        fusedBbox = this->fuse(frame, trackedBbox, trackedConfidence, detectedBboxes);
+        this->updateMotion(fusedBbox);
 
         // LEARNING
-        if (this->isValidPrevBbox)
+        // (from the detection results of the frame; without them the fern codes are computed
+        // for the windows around the fused bbox only)
+        if (this->isValidPrevBbox && isDetectorRun)
+        {
+            this->learn(fusedBbox);
+        }
+        else if (this->isValidPrevBbox)
         {
-            this->learn(frame, fusedBbox);
+            this->learnNeighborhood(frame, fusedBbox);
         }
 }
 
@@ -61,9 +171,93 @@ BBox tld::TLD::track(const cv::Mat &frame)
 } 
 
 
-std::vector<BBox> tld::TLD::detect(const cv::Mat &frame) const
+/**
+ * Decides whether the detector runs on the current frame.
+ * With DETECTOR_SCHEDULING, the detector of a stable track (valid in the previous frame and with
+ * a similarity above THETA_PLUS + SKIP_DETECTION_MARGIN) runs only every detectionInterval frames.
+ * The interval doubles after every run on a stable track, up to MAX_DETECTION_INTERVAL, and it is
+ * reset to MIN_DETECTION_INTERVAL as soon as the track becomes unstable, in which case the detector
+ * runs immediately.
+ */
+bool tld::TLD::scheduleDetector(const BBox &trackedBbox, float trackedConfidence)
+{
+    const bool isStable = this->isValidPrevBbox && !trackedBbox.empty()
+                          && trackedConfidence > params.THETA_PLUS + params.SKIP_DETECTION_MARGIN;
+    if (!params.DETECTOR_SCHEDULING || !isStable)
+    {
+        this->detectionInterval = params.MIN_DETECTION_INTERVAL;
+        this->framesSinceDetection = 0;
+        this->numDetectorRuns++;
+        return true;
+    }
+
+    this->framesSinceDetection++;
+    if (this->framesSinceDetection >= this->detectionInterval)
+    {
+        this->detectionInterval = std::min(2 * this->detectionInterval, params.MAX_DETECTION_INTERVAL);
+        this->framesSinceDetection = 0;
+        this->numDetectorRuns++;
+        return true;
+    }
+
+    this->numDetectorSkips++;
+    return false;
+}
+
+
+/**
+ * Returns the region of the frame to be scanned by the detector, an empty rect means the full frame.
+ * With ROI_DETECTION, the region is the last valid bbox enlarged by SEARCH_REGION_SCALE and by
+ * SEARCH_MOTION_FACTOR times the recent motion. The full frame is scanned if the track is lost
+ * and every FULL_SCAN_INTERVAL frames.
+ */
+cv::Rect tld::TLD::searchRegion(const cv::Size &frameSize)
+{
+    if (!params.ROI_DETECTION || !this->isValidPrevBbox || this->lastValidBbox.empty()
+        || this->framesSinceFullScan + 1 >= params.FULL_SCAN_INTERVAL)
+    {
+        this->framesSinceFullScan = 0;
+        return cv::Rect();
+    }
+    this->framesSinceFullScan++;
+
+    const cv::Point2f center(this->lastValidBbox.x + 0.5f * this->lastValidBbox.width,
+                             this->lastValidBbox.y + 0.5f * this->lastValidBbox.height);
+    const float halfWidth = 0.5f * params.SEARCH_REGION_SCALE * this->lastValidBbox.width
+                            + params.SEARCH_MOTION_FACTOR * this->recentMotion.x;
+    const float halfHeight = 0.5f * params.SEARCH_REGION_SCALE * this->lastValidBbox.height
+                             + params.SEARCH_MOTION_FACTOR * this->recentMotion.y;
+    cv::Rect region(cvFloor(center.x - halfWidth), cvFloor(center.y - halfHeight),
+                    cvCeil(2.0f * halfWidth), cvCeil(2.0f * halfHeight));
+
+    // An empty intersection falls back to the full frame
+    return region & cv::Rect(cv::Point(0, 0), frameSize);
+}
+
+
+/**
+ * Updates the last valid bbox and the smoothed motion used for the search region of the detector.
+ */
+void tld::TLD::updateMotion(const BBox &fusedBbox)
+{
+    if (!this->isValidPrevBbox || fusedBbox.empty())
+    {
+        return;
+    }
+
+    if (!this->lastValidBbox.empty())
+    {
+        const float dx = (fusedBbox.x + 0.5f * fusedBbox.width) - (this->lastValidBbox.x + 0.5f * this->lastValidBbox.width);
+        const float dy = (fusedBbox.y + 0.5f * fusedBbox.height) - (this->lastValidBbox.y + 0.5f * this->lastValidBbox.height);
+        this->recentMotion = 0.5f * this->recentMotion + 0.5f * cv::Point2f(std::abs(dx), std::abs(dy));
+    }
+    this->lastValidBbox = fusedBbox;
+}
+
+
+std::vector<BBox> tld::TLD::detect(const cv::Mat &frame, const cv::Rect &searchRegion)
 {
-    std::vector<BBox> detectedBboxes = detector.detect(frame);
+    std::vector<BBox> detectedBboxes = detector.detect(frame, &detectionResult, searchRegion);
 
     return detectedBboxes;
 }
@@ -71,6 +265,7 @@ std::vector<BBox> tld::TLD::detect(const cv::Mat &frame) const
 
 BBox tld::TLD::fuse(const cv::Mat &frame,
                     const BBox &trackedBbox,
+                    float trackedConfidence,
                     const std::vector<BBox> &detectedBboxes)
 {
     if (detectedBboxes.empty() && trackedBbox.empty())
@@ -87,15 +282,13 @@ BBox tld::TLD::fuse(const cv::Mat &frame,
     float pD = 0.0f;
     if (!detectedBboxes.empty())
     {
-        cv::Mat detectedPatch = frame(detectedBboxes[0]);
-        pD = this->detector.templateMatching(detectedPatch);
+        pD = this->detector.templateMatching(detectedBboxes[0]);
     }
 
     if (!trackedBbox.empty())
     {
         // Confidence of the tracking result
-        cv::Mat trackedPatch = frame(trackedBbox);
-        float pR = this->detector.templateMatching(trackedPatch);
+        float pR = trackedConfidence;
 
         if ((detectedBboxes.size() == 1) && (pD > pR))
         {
@@ -127,54 +320,132 @@ BBox tld::TLD::fuse(const cv::Mat &frame,
 
 
 // Called only if fusedBbox is valid (which means that the tracking bbox was selected).
-void tld::TLD::learn(const cv::Mat &frame, const BBox& fusedBbox)
+// Uses the fern codes, the confidences and the resampled patches of the detection of the same frame.
+void tld::TLD::learn(const BBox& fusedBbox)
 {
-    float pBfused = this->detector.templateMatching(frame(fusedBbox));
+    CV_Assert(this->detectionResult.confidences.size() == static_cast<std::size_t>(this->detector.grid.size()));
+
+    float pBfused = this->detector.templateMatching(fusedBbox);
     
-    for (std::size_t i = 0; i < this->detector.ensClfPool.size(); ++i)
+    const int numFerns = this->detector.ensemble.numFerns;
+    std::vector<int> windowCodes(numFerns);
+    for (int i = 0; i < this->detector.grid.size(); ++i)
     {
-        tld::EnsembleClassifier& ensClf = this->detector.ensClfPool[i];
-        BBox bbox = ensClf.bbox;
+        tld::Subwindow window = this->detector.grid.window(i);
+        BBox bbox = this->detector.grid.bbox(window);
         float overlap = tld::utils::IoU(bbox, fusedBbox);
-        float patchConfidence  = ensClf.classifyPatch(frame);
-        // P-expert (bbox is false negative)
-        if (overlap > 0.6f && patchConfidence < 0.5f)
+
+        // The windows rejected by the variance filter or rejected early by the ensemble classifier
+        // are not fully evaluated by the detector, only the ones overlapping the object are still
+        // used as positive examples.
+        const int* codes = &this->detectionResult.codes[i * numFerns];
+        float patchConfidence = this->detectionResult.confidences[i];
+        if (!this->detectionResult.hasCodes(i))
         {
-            // Update the classifier
-            for (int k = 0; k < ensClf.numFerns; ++k)
+            if (overlap <= 0.6f)
             {
-                int Fk = ensClf.ferns[k].calcFern(frame, bbox);
-                ensClf.ferns[k].numPos[Fk] += 1;
+                continue;
             }
-        }
-        // N-expert (bbox is false positive)
-        else if (overlap < 0.2f && patchConfidence > 0.5f)
-        {
-            // Update the classifier
-            for (int k = 0; k < ensClf.numFerns; ++k)
+            for (int k = 0; k < numFerns; ++k)
             {
-                int Fk = ensClf.ferns[k].calcFern(frame, bbox);
-                ensClf.ferns[k].numNeg[Fk] += 1;
+                windowCodes[k] = this->detector.ensemble.calcFern(this->detectionResult.smoothedImage, window, k);
             }
+            codes = windowCodes.data();
+            patchConfidence = this->detector.ensemble.classifyCodes(codes);
+        }
 
-            // Check to update the object model
-            //if (pBfused > params.getParams().THETA_MINUS)
+        this->updateExperts(codes, patchConfidence, bbox, overlap);
+    }
+    
+    if (pBfused < params.THETA_PLUS)  // note that pBfused > THETA_MINUS
+    {
+        this->objectModel.addPositiveTemplate(this->detector.normalizer.patch(fusedBbox));
+    }
+}
+
+
+/**
+ * Learning on a frame on which the detector was skipped (DETECTOR_SCHEDULING). The fern codes are
+ * computed on demand for the windows in the fused bbox enlarged by SEARCH_REGION_SCALE, to which the
+ * P-N experts are applied as in learn. The negatives are thus limited to the neighborhood of the
+ * object and are not checked by the variance filter.
+ */
+void tld::TLD::learnNeighborhood(const cv::Mat &frame, const BBox &fusedBbox)
+{
+    if (fusedBbox.empty())
+    {
+        return;
+    }
+
+    float pBfused = this->detector.templateMatching(fusedBbox);
+
+    const cv::Point2f center(fusedBbox.x + 0.5f * fusedBbox.width, fusedBbox.y + 0.5f * fusedBbox.height);
+    const float halfWidth = 0.5f * params.SEARCH_REGION_SCALE * fusedBbox.width;
+    const float halfHeight = 0.5f * params.SEARCH_REGION_SCALE * fusedBbox.height;
+    cv::Rect region(cvFloor(center.x - halfWidth), cvFloor(center.y - halfHeight),
+                    cvCeil(2.0f * halfWidth), cvCeil(2.0f * halfHeight));
+    region &= cv::Rect(cv::Point(0, 0), frame.size());
+
+    const tld::ScanningGrid& grid = this->detector.grid;
+    this->neighborhoodWindows.clear();
+    for (int s = 0; s < static_cast<int>(grid.scales.size()); ++s)
+    {
+        const cv::Rect range = grid.windowRange(s, region);
+        for (int row = range.y; row < range.y + range.height; ++row)
+        {
+            for (int col = range.x; col < range.x + range.width; ++col)
             {
-                cv::Mat negativeTemplate = frame(bbox);
-                cv::Mat negativeTemplateResized;
-                cv::resize(negativeTemplate, negativeTemplateResized,
-                            params.TEMPLATE_SIZE, 0, 0, cv::INTER_CUBIC);
-                this->objectModel.addNegativeTemplate(negativeTemplateResized);
+                this->neighborhoodWindows.push_back(grid.window(s, row, col));
             }
         }
     }
-    
+
+    const int numFerns = this->detector.ensemble.numFerns;
+    const int numWindows = static_cast<int>(this->neighborhoodWindows.size());
+    if (numWindows > 0)
+    {
+        this->detector.buildFernImage(frame, this->neighborhoodImage);
+        this->neighborhoodCodes.resize(numWindows * numFerns);
+        this->detector.ensemble.calcFerns(this->neighborhoodImage, this->neighborhoodWindows.data(), numWindows,
+                                          this->neighborhoodCodes.data(), &this->neighborhoodScratch);
+    }
+
+    for (int i = 0; i < numWindows; ++i)
+    {
+        BBox bbox = grid.bbox(this->neighborhoodWindows[i]);
+        const int* codes = &this->neighborhoodCodes[i * numFerns];
+        this->updateExperts(codes, this->detector.ensemble.classifyCodes(codes), bbox, tld::utils::IoU(bbox, fusedBbox));
+    }
+
     if (pBfused < params.THETA_PLUS)  // note that pBfused > THETA_MINUS
     {
-        cv::Mat positivePatch = frame(fusedBbox);
-        cv::Mat positivePatchResized;
-        cv::resize(positivePatch, positivePatchResized,
-                    params.TEMPLATE_SIZE, 0, 0, cv::INTER_CUBIC);
-        this->objectModel.addPositiveTemplate(positivePatchResized);
+        this->objectModel.addPositiveTemplate(this->detector.normalizer.patch(fusedBbox));
+    }
+}
+
+
+/**
+ * P-N experts for a single window of the grid, given its fern codes, its confidence and its overlap
+ * with the fused bbox.
+ */
+void tld::TLD::updateExperts(const int *codes, float patchConfidence, const BBox &bbox, float overlap)
+{
+    // P-expert (bbox is false negative)
+    if (overlap > 0.6f && patchConfidence < 0.5f)
+    {
+        // Update the classifier
+        this->detector.ensemble.update(codes, true);
+    }
+    // N-expert (bbox is false positive)
+    else if (overlap < 0.2f && patchConfidence > 0.5f)
+    {
+        // Update the classifier
+        this->detector.ensemble.update(codes, false);
+
+        // Check to update the object model
+        //if (pBfused > params.getParams().THETA_MINUS)
+        {
+            this->objectModel.addNegativeTemplate(this->detector.normalizer.patch(bbox));
+        }
     }
 }
\ No newline at end of file
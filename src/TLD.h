@@ -1,8 +1,11 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
 #include "MedianFlowTracker.h"
 #include "CascadeClassifier.h"
+#include "ModelFile.h"
 #include "ObjectModel.h"
 #include "Params.h"
 #include "Utils.h"
@@ -21,10 +24,33 @@ public:
 	TLD(const cv::Mat &initialFrame,
 		const BBox &initialBbox);
 
+	TLD(const cv::Mat &initialFrame,
+		const BBox &initialBbox,
+		const std::string &modelFilename);
+
+	void save(const std::string &modelFilename) const;
+
+	// The tracker, the detector and the object model point to params, rng and objectModel of this instance,
+	// so a copy or a move would leave them pointing to the original
+	TLD(const TLD&) = delete;
+	TLD& operator=(const TLD&) = delete;
+	TLD(TLD&&) = delete;
+	TLD& operator=(TLD&&) = delete;
+
 	ObjectModel objectModel;
 	MedianFlowTracker tracker;
 	CascadeClassifier detector;
 
+	// Per-window results and counters of the last detection (reused by the learning)
+	DetectionResult detectionResult;
+
+	// Time of the construction (up to the first learning) in milliseconds
+	double startupTime;
+
+	// Counters of the detector scheduling (DETECTOR_SCHEDULING)
+	int numDetectorRuns;
+	int numDetectorSkips;
+
 	void run(const cv::Mat &frame,
 			BBox &trackedBbox,
 			std::vector<BBox> &detectedBboxes,
@@ -35,17 +61,49 @@ private:
 
 	tld::utils::Random rng;
 
+	// Mapped model file the object model and the detector were loaded from (if any),
+	// their learned arrays live in it
+	std::shared_ptr<ModelFile> modelFile;
+
 	bool isValidPrevBbox;
+
+	// State of the search region of the detector (ROI_DETECTION)
+	BBox lastValidBbox;
+	cv::Point2f recentMotion;  // smoothed absolute displacement of the valid bbox per frame
+	int framesSinceFullScan;
+
+	// State of the detector scheduling (DETECTOR_SCHEDULING)
+	int detectionInterval;
+	int framesSinceDetection;
+
+	// Buffers of the learning on the frames without detection (see learnNeighborhood)
+	cv::Mat neighborhoodImage;
+	std::vector<Subwindow> neighborhoodWindows;
+	std::vector<int> neighborhoodCodes;
+	FernScratch neighborhoodScratch;
 	
+	void initialize();
+
 	BBox track(const cv::Mat &frame);
 
-	std::vector<BBox> detect(const cv::Mat &frame) const;
+	bool scheduleDetector(const BBox &trackedBbox, float trackedConfidence);
+
+	cv::Rect searchRegion(const cv::Size &frameSize);
+
+	void updateMotion(const BBox &fusedBbox);
+
+	std::vector<BBox> detect(const cv::Mat &frame, const cv::Rect &searchRegion = cv::Rect());
 
 	BBox fuse(const cv::Mat &frame,
 			  const BBox &trackedBbox,
+			  float trackedConfidence,
 			  const std::vector<BBox> &detectedBboxes);
 
-	void learn(const cv::Mat &frame, const BBox& fusedBbox);
+	void learn(const BBox& fusedBbox);
+
+	void learnNeighborhood(const cv::Mat &frame, const BBox &fusedBbox);
+
+	void updateExperts(const int *codes, float patchConfidence, const BBox &bbox, float overlap);
 
 };
 
@@ -0,0 +1,146 @@
+#include <algorithm>  // std::min, std::max, std::max_element, std::nth_element
+#include <cmath>      // std::cos, std::sqrt
+#include <numeric>    // std::iota
+#include "NCCKernel.h"
+#include "TemplateIndex.h"
+
+
+/**
+ * Margin added to the bounds, so that the float rounding of the projections never
+ * prunes the template with the largest NCC.
+ */
+static const float BOUND_MARGIN = 1e-3f;
+
+
+/**
+ * Constructor of TemplateIndex.
+ * The basis consists of the numDimensions DCT basis vectors of the lowest frequencies,
+ * without the constant one (the normalized templates have zero mean).
+ */
+tld::TemplateIndex::TemplateIndex(const cv::Size& templateSize, std::size_t capacity, int numDimensions)
+{
+    const int width = templateSize.width;
+    const int height = templateSize.height;
+    numDimensions = std::min(numDimensions, templateSize.area() - 1);
+    CV_Assert(numDimensions > 0 && capacity > 0);
+
+    // Frequencies (u, v) ordered by u + v, i.e. diagonal by diagonal
+    std::vector<cv::Point> frequencies;
+    for (int diagonal = 1; static_cast<int>(frequencies.size()) < numDimensions; ++diagonal)
+    {
+        for (int u = 0; u <= diagonal; ++u)
+        {
+            const int v = diagonal - u;
+            if (u < width && v < height && static_cast<int>(frequencies.size()) < numDimensions)
+            {
+                frequencies.push_back(cv::Point(u, v));
+            }
+        }
+    }
+
+    auto dct = [](int k, int x, int n)
+    {
+        const double scale = std::sqrt((k == 0 ? 1.0 : 2.0) / n);
+        return scale * std::cos(CV_PI * (2 * x + 1) * k / (2.0 * n));
+    };
+
+    this->basis = cv::Mat(numDimensions, templateSize.area(), CV_32F);
+    for (int d = 0; d < numDimensions; ++d)
+    {
+        float* const basisRowPtr = this->basis.ptr<float>(d);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                basisRowPtr[y * width + x] = static_cast<float>(dct(frequencies[d].x, x, width) * dct(frequencies[d].y, y, height));
+            }
+        }
+    }
+
+    this->projections = cv::Mat::zeros(static_cast<int>(capacity), numDimensions, CV_32F);
+    this->residualNorms = std::vector<float>(capacity, 0.0f);
+}
+
+
+/**
+ * Indexes the normalized template stored at the given row (replacing the previous one).
+ */
+void tld::TemplateIndex::update(std::size_t row, const float* vector)
+{
+    this->residualNorms[row] = this->project(vector, this->projections.ptr<float>(static_cast<int>(row)));
+}
+
+
+/**
+ * Returns the largest NCC of the normalized patch vector to the templates (rows of
+ * templateVectors, indexed in the same rows), -1 if there are none. If numCandidates is
+ * positive, only the numCandidates templates with the largest bounds are evaluated.
+ */
+float tld::TemplateIndex::maxNCC(const float* vector, const cv::Mat& templateVectors, int numCandidates) const
+{
+    const int numTemplates = templateVectors.rows;
+    const int numDimensions = this->basis.rows;
+    const int length = templateVectors.cols;
+
+    const tld::kernels::DotF32Kernel dot = tld::kernels::dotF32Kernel();
+
+    std::vector<float> projection(numDimensions);
+    const float residualNorm = this->project(vector, projection.data());
+
+    std::vector<float> bounds(numTemplates);
+    for (int j = 0; j < numTemplates; ++j)
+    {
+        bounds[j] = dot(projection.data(), this->projections.ptr<float>(j), numDimensions)
+                    + residualNorm * this->residualNorms[j] + BOUND_MARGIN;
+    }
+
+    auto ncc = [&](int j) { return dot(vector, templateVectors.ptr<float>(j), length); };
+
+    float best = -1.0f;
+    if (numCandidates > 0 && numCandidates < numTemplates)
+    {
+        // Approximate search: the numCandidates largest bounds
+        std::vector<int> order(numTemplates);
+        std::iota(order.begin(), order.end(), 0);
+        std::nth_element(order.begin(), order.begin() + numCandidates, order.end(),
+                         [&bounds](int a, int b) { return bounds[a] > bounds[b]; });
+        for (int i = 0; i < numCandidates; ++i)
+        {
+            best = std::max(best, ncc(order[i]));
+        }
+    }
+    else if (numTemplates > 0)
+    {
+        // Exact search: the template with the largest bound is usually close to the best one,
+        // after which only the templates whose bounds exceed the best NCC found are evaluated
+        const int first = static_cast<int>(std::max_element(bounds.begin(), bounds.end()) - bounds.begin());
+        best = ncc(first);
+        for (int j = 0; j < numTemplates; ++j)
+        {
+            if (bounds[j] > best && j != first)
+            {
+                best = std::max(best, ncc(j));
+            }
+        }
+    }
+
+    return best;
+}
+
+
+/**
+ * Projects the vector onto the basis and returns the norm of its residual.
+ */
+float tld::TemplateIndex::project(const float* vector, float* projection) const
+{
+    const int length = this->basis.cols;
+    float projectionSqNorm = 0.0f;
+    for (int d = 0; d < this->basis.rows; ++d)
+    {
+        projection[d] = tld::kernels::dotF32(vector, this->basis.ptr<float>(d), length);
+        projectionSqNorm += projection[d] * projection[d];
+    }
+    const float sqNorm = tld::kernels::dotF32(vector, vector, length);
+
+    return std::sqrt(std::max(0.0f, sqNorm - projectionSqNorm));
+}
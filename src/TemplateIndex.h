@@ -0,0 +1,38 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <vector>
+
+
+namespace tld
+{
+/**
+ * Nearest-neighbour index over the normalized templates of a TemplateStore (one per row).
+ * Every template is projected onto the lowest frequencies of the orthonormal 2D DCT basis,
+ * where most of the energy of image patches lies. For unit vectors x and t with projections
+ * px, pt and residual norms rx, rt, the Cauchy-Schwarz inequality bounds their NCC:
+ *    x . t <= px . pt + rx * rt
+ * The exact search evaluates only the templates whose bounds exceed the best NCC found so far,
+ * so it returns the same value as a linear scan.
+ * The approximate search evaluates only the given number of templates with the largest bounds.
+ */
+class TemplateIndex
+{
+public:
+    TemplateIndex() = default;
+    TemplateIndex(const cv::Size& templateSize, std::size_t capacity, int numDimensions);
+
+    void update(std::size_t row, const float* vector);
+
+    float maxNCC(const float* vector, const cv::Mat& templateVectors, int numCandidates = 0) const;
+
+private:
+    cv::Mat basis;                    // CV_32F, numDimensions x templateSize.area()
+    cv::Mat projections;              // CV_32F, capacity x numDimensions
+    std::vector<float> residualNorms; // norm of the part of each template outside the basis
+
+    float project(const float* vector, float* projection) const;
+};
+
+} // namespace tld
@@ -0,0 +1,389 @@
+#include <algorithm>  // std::max, std::max_element
+#include <bitset>
+#include <vector>
+#include "NCCKernel.h"
+#include "TemplateStore.h"
+#include "Utils.h"
+
+
+/**
+ * 64-bit difference hash of the template: the signs of the horizontal differences
+ * of its 9x8 area-averaged thumbnail. Like the NCC, it ignores brightness and contrast.
+ */
+static std::uint64_t differenceHash(const cv::Mat& patch)
+{
+    cv::Mat thumbnail;
+    cv::resize(patch, thumbnail, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+    std::uint64_t hash = 0;
+    for (int i = 0; i < thumbnail.rows; ++i)
+    {
+        const uchar* const thumbnailRowPtr = thumbnail.ptr<uchar>(i);
+        for (int j = 0; j + 1 < thumbnail.cols; ++j)
+        {
+            hash = (hash << 1) | (thumbnailRowPtr[j] < thumbnailRowPtr[j + 1]);
+        }
+    }
+
+    return hash;
+}
+
+
+/**
+ * Constructor of TemplateStore. The templates are indexed if indexDimensions is positive.
+ * The signatures and the NCCs of the redundancy checks are kept only if trackRedundancy is set.
+ */
+tld::TemplateStore::TemplateStore(const cv::Size& templateSize, std::size_t capacity,
+                                  int indexDimensions, int indexCandidates, bool trackRedundancy)
+{
+    CV_Assert(!templateSize.empty() && capacity > 0);
+
+    this->templateSize = templateSize;
+    this->capacity = capacity;
+    this->patches = cv::Mat::zeros(static_cast<int>(capacity), templateSize.area(), CV_8UC1);
+    this->normalizedVectors = cv::Mat::zeros(static_cast<int>(capacity), templateSize.area(), CV_32F);
+    if (trackRedundancy)
+    {
+        this->isRedundancyTracked = true;
+        this->signatures = std::vector<std::uint64_t>(capacity, 0);
+        this->similarities = cv::Mat::zeros(static_cast<int>(capacity), static_cast<int>(capacity), CV_32F);
+    }
+
+    if (indexDimensions > 0)
+    {
+        this->isIndexed = true;
+        this->indexCandidates = indexCandidates;
+        this->index = TemplateIndex(templateSize, capacity, indexDimensions);
+    }
+}
+
+
+/**
+ * Size and ring-buffer state of a template store in a model file.
+ */
+struct TemplatesInfo
+{
+    std::int32_t templateWidth;
+    std::int32_t templateHeight;
+    std::uint64_t capacity;
+    std::uint64_t count;
+    std::uint64_t head;
+};
+
+
+/**
+ * Constructor of TemplateStore from the sections of a model file starting at section (see save).
+ * The templates and their NCCs are used in place in the mapped file, the index is rebuilt.
+ * If redundancy is tracked but the file has no signatures and NCCs, they are recomputed.
+ */
+tld::TemplateStore::TemplateStore(const ModelFile& file, std::uint32_t section,
+                                  int indexDimensions, int indexCandidates, bool trackRedundancy)
+{
+    const TemplatesInfo info = file.value<TemplatesInfo>(section + TEMPLATES_INFO);
+    CV_Assert(info.templateWidth > 0 && info.templateHeight > 0 && info.capacity > 0
+              && info.count <= info.capacity && info.head < info.capacity
+              && (info.count == info.capacity || info.head == 0));
+
+    this->templateSize = cv::Size(info.templateWidth, info.templateHeight);
+    this->capacity = info.capacity;
+    this->count = info.count;
+    this->head = info.head;
+
+    const int rows = static_cast<int>(this->capacity);
+    const int area = this->templateSize.area();
+    const std::size_t numEntries = this->capacity * area;
+    this->patches = cv::Mat(rows, area, CV_8UC1, file.section<uchar>(section + TEMPLATES_PATCHES, numEntries));
+    this->normalizedVectors = cv::Mat(rows, area, CV_32F, file.section<float>(section + TEMPLATES_VECTORS, numEntries));
+
+    if (trackRedundancy)
+    {
+        this->isRedundancyTracked = true;
+        if (file.hasSection(section + TEMPLATES_SIGNATURES) && file.hasSection(section + TEMPLATES_SIMILARITIES))
+        {
+            this->similarities = cv::Mat(rows, rows, CV_32F,
+                                         file.section<float>(section + TEMPLATES_SIMILARITIES, this->capacity * this->capacity));
+            const std::uint64_t* const signaturesData = file.section<std::uint64_t>(section + TEMPLATES_SIGNATURES, this->capacity);
+            this->signatures = std::vector<std::uint64_t>(signaturesData, signaturesData + this->capacity);
+        }
+        else
+        {
+            this->signatures = std::vector<std::uint64_t>(this->capacity, 0);
+            this->similarities = cv::Mat::zeros(rows, rows, CV_32F);
+            for (std::size_t i = 0; i < this->count; ++i)
+            {
+                this->updateRedundancy(this->row(i));
+            }
+        }
+    }
+
+    if (indexDimensions > 0)
+    {
+        this->isIndexed = true;
+        this->indexCandidates = indexCandidates;
+        this->index = TemplateIndex(this->templateSize, this->capacity, indexDimensions);
+        for (std::size_t i = 0; i < this->count; ++i)
+        {
+            const std::size_t r = this->row(i);
+            this->index.update(r, this->normalizedVectors.ptr<float>(static_cast<int>(r)));
+        }
+    }
+}
+
+
+/**
+ * Adds the templates, their signatures and NCCs (if redundancy is tracked) and the ring-buffer state
+ * to the model file, as the sections starting at section.
+ */
+void tld::TemplateStore::save(ModelWriter& writer, std::uint32_t section) const
+{
+    const TemplatesInfo info = {this->templateSize.width, this->templateSize.height,
+                                this->capacity, this->count, this->head};
+    writer.addSection(section + TEMPLATES_INFO, info);
+    writer.addSection(section + TEMPLATES_PATCHES, this->patches.data, this->patches.total() * this->patches.elemSize());
+    writer.addSection(section + TEMPLATES_VECTORS, this->normalizedVectors.data,
+                      this->normalizedVectors.total() * this->normalizedVectors.elemSize());
+    if (this->isRedundancyTracked)
+    {
+        writer.addSection(section + TEMPLATES_SIGNATURES, this->signatures.data(), this->signatures.size() * sizeof(std::uint64_t));
+        writer.addSection(section + TEMPLATES_SIMILARITIES, this->similarities.data,
+                          this->similarities.total() * this->similarities.elemSize());
+    }
+}
+
+
+std::size_t tld::TemplateStore::size() const
+{
+    return this->count;
+}
+
+
+bool tld::TemplateStore::empty() const
+{
+    return this->count == 0;
+}
+
+
+bool tld::TemplateStore::full() const
+{
+    return this->count == this->capacity;
+}
+
+
+std::size_t tld::TemplateStore::maxSize() const
+{
+    return this->capacity;
+}
+
+
+cv::Size tld::TemplateStore::patchSize() const
+{
+    return this->templateSize;
+}
+
+
+/**
+ * Appends the template as the newest one. If the store is full, the oldest template is replaced.
+ */
+void tld::TemplateStore::push(const cv::Mat& newTemplate)
+{
+    if (this->full())
+    {
+        this->store(this->head, newTemplate);
+        this->head = (this->head + 1) % this->capacity;
+    }
+    else
+    {
+        this->store(this->row(this->count), newTemplate);
+        this->count++;
+    }
+}
+
+
+/**
+ * Replaces the i-th template (the order of the templates does not change).
+ */
+void tld::TemplateStore::replace(std::size_t i, const cv::Mat& newTemplate)
+{
+    CV_Assert(i < this->count);
+    this->store(this->row(i), newTemplate);
+}
+
+
+/**
+ * Returns the original pixels of the i-th template (a templateSize header to the store).
+ */
+cv::Mat tld::TemplateStore::operator[](std::size_t i) const
+{
+    CV_Assert(i < this->count);
+    return this->patches.row(static_cast<int>(this->row(i))).reshape(1, this->templateSize.height);
+}
+
+
+/**
+ * Returns the normalized templates, one row per template. The rows are in the storage order,
+ * which is not the order of the templates once the ring buffer wraps around.
+ */
+cv::Mat tld::TemplateStore::vectors() const
+{
+    return this->normalizedVectors.rowRange(0, static_cast<int>(this->count));
+}
+
+
+/**
+ * Returns the largest NCC of the normalized patch vector to the templates, -1 if the store is empty.
+ */
+float tld::TemplateStore::maxNCC(const float* vector) const
+{
+    const cv::Mat templateVectors = this->vectors();
+    if (this->isIndexed)
+    {
+        return this->index.maxNCC(vector, templateVectors, this->indexCandidates);
+    }
+
+    const tld::kernels::DotF32Kernel dot = tld::kernels::dotF32Kernel();
+    float best = -1.0f;
+    for (int j = 0; j < templateVectors.rows; ++j)
+    {
+        best = std::max(best, dot(vector, templateVectors.ptr<float>(j), templateVectors.cols));
+    }
+    return best;
+}
+
+
+/**
+ * Writes the largest NCC of every normalized patch vector (rows of patchVectors) to the templates
+ * to result, -1 if the store is empty. Without an index, the NCCs of all the patches to all
+ * the templates are the entries of a single matrix product.
+ */
+void tld::TemplateStore::maxNCC(const cv::Mat& patchVectors, float* result) const
+{
+    CV_Assert(patchVectors.type() == CV_32F);
+    if (this->empty() || this->isIndexed)
+    {
+        for (int i = 0; i < patchVectors.rows; ++i)
+        {
+            result[i] = this->maxNCC(patchVectors.ptr<float>(i));
+        }
+        return;
+    }
+
+    // NCCs of the patches (rows) to the templates (columns)
+    cv::Mat ncc;
+    cv::gemm(patchVectors, this->vectors(), 1.0, cv::Mat(), 0.0, ncc, cv::GEMM_2_T);
+    for (int i = 0; i < patchVectors.rows; ++i)
+    {
+        const float* const nccRowPtr = ncc.ptr<float>(i);
+        result[i] = *std::max_element(nccRowPtr, nccRowPtr + ncc.cols);
+    }
+}
+
+
+/**
+ * Returns true if the NCC of the new template to one of the templates exceeds nccThreshold.
+ * Only the templates whose difference hashes are within maxHashDistance bits of the hash
+ * of the new template are compared by NCC.
+ */
+bool tld::TemplateStore::isRedundant(const cv::Mat& newTemplate, float nccThreshold, int maxHashDistance) const
+{
+    CV_Assert(this->isRedundancyTracked);
+    CV_Assert(newTemplate.size() == this->templateSize && newTemplate.type() == CV_8UC1);
+
+    const std::uint64_t signature = differenceHash(newTemplate);
+    std::vector<float> vector;
+    for (std::size_t i = 0; i < this->count; ++i)
+    {
+        const std::size_t r = this->row(i);
+        if (static_cast<int>(std::bitset<64>(signature ^ this->signatures[r]).count()) > maxHashDistance)
+        {
+            continue;
+        }
+        if (vector.empty())
+        {
+            vector.resize(this->templateSize.area());
+            tld::utils::normalizePatch(newTemplate, vector.data());
+        }
+        const float* const templateVector = this->normalizedVectors.ptr<float>(static_cast<int>(r));
+        if (tld::kernels::dotF32(vector.data(), templateVector, static_cast<int>(vector.size())) > nccThreshold)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Returns the index of the most redundant template, i.e. the one with the largest NCC to another
+ * template (the oldest one on ties).
+ */
+std::size_t tld::TemplateStore::mostRedundant() const
+{
+    CV_Assert(this->isRedundancyTracked && this->count > 0);
+
+    std::size_t mostRedundant = 0;
+    float largestNCC = -2.0f;
+    for (std::size_t i = 0; i < this->count; ++i)
+    {
+        const float* const similaritiesRowPtr = this->similarities.ptr<float>(static_cast<int>(this->row(i)));
+        for (std::size_t j = 0; j < this->count; ++j)
+        {
+            if (j != i && similaritiesRowPtr[this->row(j)] > largestNCC)
+            {
+                largestNCC = similaritiesRowPtr[this->row(j)];
+                mostRedundant = i;
+            }
+        }
+    }
+
+    return mostRedundant;
+}
+
+
+std::size_t tld::TemplateStore::row(std::size_t i) const
+{
+    return (this->head + i) % this->capacity;
+}
+
+
+void tld::TemplateStore::store(std::size_t row, const cv::Mat& newTemplate)
+{
+    CV_Assert(newTemplate.size() == this->templateSize && newTemplate.type() == CV_8UC1);
+
+    cv::Mat patch = this->patches.row(static_cast<int>(row)).reshape(1, this->templateSize.height);
+    newTemplate.copyTo(patch);
+    float* const vector = this->normalizedVectors.ptr<float>(static_cast<int>(row));
+    tld::utils::normalizePatch(newTemplate, vector);
+    if (this->isIndexed)
+    {
+        this->index.update(row, vector);
+    }
+    if (this->isRedundancyTracked)
+    {
+        this->updateRedundancy(row);
+    }
+}
+
+
+/**
+ * Updates the signature of the template in the given row and its NCCs to the other stored templates.
+ */
+void tld::TemplateStore::updateRedundancy(std::size_t row)
+{
+    const int r0 = static_cast<int>(row);
+    this->signatures[row] = differenceHash(this->patches.row(r0).reshape(1, this->templateSize.height));
+
+    const tld::kernels::DotF32Kernel dot = tld::kernels::dotF32Kernel();
+    const float* const vector = this->normalizedVectors.ptr<float>(r0);
+    const int length = this->templateSize.area();
+    for (std::size_t i = 0; i < this->count; ++i)
+    {
+        const int r = static_cast<int>(this->row(i));
+        if (r != r0)
+        {
+            const float ncc = dot(vector, this->normalizedVectors.ptr<float>(r), length);
+            this->similarities.at<float>(r0, r) = ncc;
+            this->similarities.at<float>(r, r0) = ncc;
+        }
+    }
+}
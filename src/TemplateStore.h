@@ -0,0 +1,84 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ModelFile.h"
+#include "TemplateIndex.h"
+
+
+namespace tld
+{
+/**
+ * Fixed-capacity ring buffer of same-size templates.
+ * Every template is stored twice, as the original pixels (for display) and normalized
+ * to zero mean and unit norm (see tld::utils::normalizePatch), one row per template
+ * of two contiguous matrices. The NCC of a normalized patch to all the templates is thus
+ * a product with vectors(). If the store is indexed (indexDimensions > 0), maxNCC searches
+ * the templates with a TemplateIndex, which is kept up to date by push and replace.
+ * For the redundancy checks (isRedundant, mostRedundant), a store that tracks redundancy also keeps
+ * a 64-bit difference hash of every template and the NCCs between all pairs of stored templates.
+ * The templates are indexed from the oldest (0) to the newest (size() - 1).
+ */
+class TemplateStore
+{
+public:
+    TemplateStore() = default;
+    TemplateStore(const cv::Size& templateSize, std::size_t capacity,
+                  int indexDimensions = 0, int indexCandidates = 0, bool trackRedundancy = false);
+    TemplateStore(const ModelFile& file, std::uint32_t section,
+                  int indexDimensions = 0, int indexCandidates = 0, bool trackRedundancy = false);
+
+    void save(ModelWriter& writer, std::uint32_t section) const;
+
+    std::size_t size() const;
+
+    bool empty() const;
+
+    bool full() const;
+
+    std::size_t maxSize() const;
+
+    cv::Size patchSize() const;
+
+    void push(const cv::Mat& newTemplate);
+
+    void replace(std::size_t i, const cv::Mat& newTemplate);
+
+    cv::Mat operator[](std::size_t i) const;
+
+    cv::Mat vectors() const;
+
+    float maxNCC(const float* vector) const;
+
+    void maxNCC(const cv::Mat& patchVectors, float* result) const;
+
+    bool isRedundant(const cv::Mat& newTemplate, float nccThreshold, int maxHashDistance) const;
+
+    std::size_t mostRedundant() const;
+
+private:
+    cv::Size templateSize;
+    std::size_t capacity = 0;
+    std::size_t count = 0;
+    std::size_t head = 0;  // row of the oldest template
+
+    cv::Mat patches;            // CV_8UC1, capacity x templateSize.area()
+    cv::Mat normalizedVectors;  // CV_32F, capacity x templateSize.area()
+    bool isRedundancyTracked = false;
+    std::vector<std::uint64_t> signatures;  // difference hash of each row (if isRedundancyTracked)
+    cv::Mat similarities;       // CV_32F, capacity x capacity, NCCs between the rows (if isRedundancyTracked)
+
+    bool isIndexed = false;
+    int indexCandidates = 0;    // templates evaluated per search, 0 for the exact search
+    TemplateIndex index;
+
+    std::size_t row(std::size_t i) const;
+
+    void store(std::size_t row, const cv::Mat& newTemplate);
+
+    void updateRedundancy(std::size_t row);
+};
+
+} // namespace tld
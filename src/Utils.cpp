@@ -5,8 +5,8 @@
 #include <sstream>
 #include <fstream>
 #include <limits>
-#include <queue>
-#include <set>
+#include <numeric>    // std::iota, std::partial_sum
+#include "NCCKernel.h"
 #include "Utils.h"
 
 
@@ -32,8 +32,8 @@ tld::utils::Random::Random(unsigned int seed)
  */
 float tld::utils::Random::randf(float low, float high)
 {
-    std::uniform_real_distribution<float> distribution(low, high);
-    return distribution(engine);  // [low, high)
+    using Param = std::uniform_real_distribution<float>::param_type;
+    return this->uniformReal(engine, Param(low, high));  // [low, high)
 }
 
 /**
@@ -41,8 +41,8 @@ float tld::utils::Random::randf(float low, float high)
  */
 int tld::utils::Random::randi(int low, int high)
 {
-    std::uniform_int_distribution<int> distribution(low, high);
-    return distribution(engine);  // [low, high]
+    using Param = std::uniform_int_distribution<int>::param_type;
+    return this->uniformInt(engine, Param(low, high));  // [low, high]
 }
 
 
@@ -70,19 +70,28 @@ float tld::utils::round(float x, unsigned int n)
  */
 float tld::utils::median(std::vector<float> values)
 {
-    if (values.empty())
+    return tld::utils::median(values.data(), values.size());
+}
+
+
+/**
+ * Median of the n values, computed in place (the values are reordered).
+ */
+float tld::utils::median(float *values, std::size_t n)
+{
+    if (n == 0)
     {
         return 0.0f;
     }
     
-    int midIndex = static_cast<int>(values.size() / 2);
-    std::nth_element(values.begin(), values.begin() + midIndex, values.end());
+    std::size_t midIndex = n / 2;
+    std::nth_element(values, values + midIndex, values + n);
 
     float midVal = values[midIndex];
 
-    if (values.size() % 2 == 0)
+    if (n % 2 == 0)
     {
-        return (midVal + *std::max_element(values.begin(), values.begin() + midIndex)) * 0.5f;
+        return (midVal + *std::max_element(values, values + midIndex)) * 0.5f;
     }
     else
     {
@@ -91,6 +100,82 @@ float tld::utils::median(std::vector<float> values)
 }
 
 
+/**
+ * Number of random pairs such that, with probability at least 0.99, the median of their ratios lies
+ * between the (0.5 - rankTolerance) and (0.5 + rankTolerance) quantiles of the ratios of all the pairs.
+ * By the Dvoretzky-Kiefer-Wolfowitz inequality n = ln(2 / delta) / (2 * rankTolerance^2).
+ */
+int tld::utils::scaleSampleBudget(float rankTolerance)
+{
+    CV_Assert(rankTolerance > 0.0f);
+    const double delta = 0.01;
+    return static_cast<int>(std::ceil(std::log(2.0 / delta) / (2.0 * rankTolerance * rankTolerance)));
+}
+
+
+/**
+ * Computes the change of scale between two sets of corresponding points as the median of the ratios
+ * of the pairwise distances. The exact median needs all the n(n-1)/2 pairs, if there are more of them
+ * than scaleSampleBudget(rankTolerance) the pairs are drawn at random (with replacement) instead,
+ * so the cost does not grow with the number of points.
+ */
+float tld::utils::medianScaleChange(const std::vector<cv::Point2f> &points1,
+                                    const std::vector<cv::Point2f> &points2,
+                                    float rankTolerance,
+                                    Random *rng)
+{
+    CV_Assert(points1.size() == points2.size());
+    const int numPoints = static_cast<int>(points1.size());
+    const double numPairs = 0.5 * numPoints * (numPoints - 1.0);
+
+    std::vector<float> scales;
+    auto addPair = [&](int i, int j)
+    {
+        cv::Point2f p1 = points1[i] - points1[j];
+        cv::Point2f p2 = points2[i] - points2[j];
+        float s1 = std::hypot(p1.x, p1.y);
+        float s2 = std::hypot(p2.x, p2.y);
+        if (s1 != 0 && s2 != 0)
+        {
+            scales.push_back(s2 / s1);
+        }
+    };
+
+    if (rankTolerance > 0.0f && rng != nullptr && numPairs > scaleSampleBudget(rankTolerance))
+    {
+        const int numSamples = scaleSampleBudget(rankTolerance);
+        scales.reserve(numSamples);
+        for (int k = 0; k < numSamples; ++k)
+        {
+            int i = rng->randi(0, numPoints - 1);
+            int j = rng->randi(0, numPoints - 2);
+            if (j >= i)
+            {
+                ++j;
+            }
+            addPair(i, j);
+        }
+    }
+    else
+    {
+        scales.reserve(static_cast<std::size_t>(numPairs));
+        for (int i = 0; i < numPoints; ++i)
+        {
+            for (int j = i + 1; j < numPoints; ++j)
+            {
+                addPair(i, j);
+            }
+        }
+    }
+
+    if (scales.empty())
+    {
+        return 1.0f;
+    }
+    return median(std::move(scales));
+}
+
+
 /**
  * Checks if the patch is within the image boundaries.
  */
@@ -132,10 +217,27 @@ cv::Mat tld::utils::getPatch(const cv::Mat& image, cv::Point2f patchCenter, cv::
 }
 
 
+/**
+ * Window of the patch of the given size centered at the point (as getPatch), clipped to the image.
+ * The top-left corner is rounded to the nearest pixel and the window is clipped with integers.
+ * The width or the height is <= 0 if the patch lies outside of the image.
+ */
+static cv::Rect clippedPatchWindow(const cv::Mat& image, cv::Point2f patchCenter, cv::Size patchSize)
+{
+    int x1 = cvRound(patchCenter.x - patchSize.width / 2.0f);
+    int y1 = cvRound(patchCenter.y - patchSize.height / 2.0f);
+    int x2 = std::min(x1 + patchSize.width, image.cols);
+    int y2 = std::min(y1 + patchSize.height, image.rows);
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    return cv::Rect(x1, y1, x2 - x1, y2 - y1);
+}
+
+
 /**
  * Computes Normalized Correlation Coefficient (NCC) according to the formula:
  *    NCC = (1 / N) * sum[(patch1 - mean1) * (patch2 - mean2) / (sigma1 * sigma2)]
- * The values are in the range -1 to 1.
+ * The values are in the range -1 to 1, the NCC of a constant patch is 0.
  */
 float tld::utils::computeNCC(const cv::Mat& patch1, const cv::Mat& patch2)
 {
@@ -161,10 +263,128 @@ float tld::utils::computeNCC(const cv::Mat& patch1, const cv::Mat& patch2)
 
     // return ncc;
 
-    cv::Mat ncc;
-    cv::matchTemplate(patch1, patch2, ncc, cv::TM_CCOEFF_NORMED);
+    // Same as cv::matchTemplate(patch1, patch2, ncc, cv::TM_CCOEFF_NORMED) at (0, 0),
+    // i.e. over the common top-left part of the patches, without allocating the result
+    CV_Assert(patch1.type() == CV_8UC1 && patch2.type() == CV_8UC1);
+    const int width = std::min(patch1.cols, patch2.cols);
+    const int height = std::min(patch1.rows, patch2.rows);
+
+    return tld::kernels::nccU8(patch1.data, patch1.step[0], patch2.data, patch2.step[0], width, height);
+}
+
+
+/**
+ * Batched computeNCC(getPatch(image1, points1[i], patchSize), getPatch(image2, points2[i], patchSize))
+ * of the masked point pairs. The windows are clipped with integers and the NCC is computed directly
+ * on the image rows, so nothing is allocated. The kernel is chosen once for the patch size
+ * (the scalar one for NCC_PATCH_SIZE). The result buffer must hold numPoints values.
+ */
+int tld::utils::computeNCCBatch(const cv::Mat& image1, const cv::Point2f* points1,
+                                const cv::Mat& image2, const cv::Point2f* points2,
+                                const unsigned char* mask, int numPoints,
+                                cv::Size patchSize, float* ncc)
+{
+    CV_Assert(image1.type() == CV_8UC1 && image2.type() == CV_8UC1);
+
+    const tld::kernels::NccU8Kernel nccKernel = tld::kernels::nccU8Kernel(patchSize.width);
+    int numValues = 0;
+    for (int i = 0; i < numPoints; ++i)
+    {
+        if (mask[i] == 0)
+        {
+            continue;
+        }
+
+        const cv::Rect window1 = clippedPatchWindow(image1, points1[i], patchSize);
+        const cv::Rect window2 = clippedPatchWindow(image2, points2[i], patchSize);
+
+        // Common top-left part of the patches (as computeNCC)
+        const int width = std::min(window1.width, window2.width);
+        const int height = std::min(window1.height, window2.height);
+        if (width <= 0 || height <= 0)
+        {
+            ncc[numValues++] = 0.0f;
+            continue;
+        }
+
+        ncc[numValues++] = nccKernel(image1.ptr<uchar>(window1.y) + window1.x, image1.step[0],
+                                     image2.ptr<uchar>(window2.y) + window2.x, image2.step[0],
+                                     width, height);
+    }
+
+    return numValues;
+}
+
+
+/**
+ * Writes the pixels of the patch to vector (row by row) normalized to zero mean and unit norm,
+ * so that the NCC of two patches of the same size is the dot product of their vectors.
+ * The vector of a constant patch is all zeros.
+ */
+void tld::utils::normalizePatch(const cv::Mat& patch, float* vector)
+{
+    CV_Assert(patch.type() == CV_8UC1);
+
+    const int nRows = patch.rows;
+    const int nCols = patch.cols;
 
-    return ncc.at<float>(0, 0);
+    double sum = 0.0;
+    for (int i = 0; i < nRows; ++i)
+    {
+        const uchar* const patchRowPtr = patch.ptr<uchar>(i);
+        for (int j = 0; j < nCols; ++j)
+        {
+            sum += patchRowPtr[j];
+        }
+    }
+    const float mean = static_cast<float>(sum / (nRows * nCols));
+
+    double sqNorm = 0.0;
+    float* vectorPtr = vector;
+    for (int i = 0; i < nRows; ++i)
+    {
+        const uchar* const patchRowPtr = patch.ptr<uchar>(i);
+        for (int j = 0; j < nCols; ++j)
+        {
+            const float val = patchRowPtr[j] - mean;
+            *vectorPtr++ = val;
+            sqNorm += val * val;
+        }
+    }
+
+    const float invNorm = (sqNorm > 0.0) ? static_cast<float>(1.0 / std::sqrt(sqNorm)) : 0.0f;
+    for (int k = 0; k < nRows * nCols; ++k)
+    {
+        vector[k] *= invNorm;
+    }
+}
+
+
+/**
+ * Approximates a Gaussian blur with the given sigma by three successive box filters,
+ * whose cost does not depend on sigma (unlike cv::GaussianBlur with a kernel of about 6 * sigma).
+ * The widths of the boxes are chosen so that the variance of the result matches sigma^2.
+ */
+void tld::utils::approxGaussianBlur(const cv::Mat& image, cv::Mat& blurred, float sigma)
+{
+    const int numPasses = 3;
+
+    // Largest odd width below the ideal one, m passes of width wl and the rest of width wl + 2
+    const float idealWidth = std::sqrt(12.0f * sigma * sigma / numPasses + 1.0f);
+    int wl = static_cast<int>(std::floor(idealWidth));
+    if (wl % 2 == 0)
+    {
+        wl--;
+    }
+    const int m = cvRound((12.0f * sigma * sigma - numPasses * wl * wl - 4.0f * numPasses * wl - 3.0f * numPasses) / (-4.0f * wl - 4.0f));
+
+    const cv::Mat* src = &image;
+    for (int i = 0; i < numPasses; ++i)
+    {
+        const int w = (i < m) ? wl : wl + 2;
+        cv::blur(*src, blurred, cv::Size(w, w));
+        src = &blurred;
+    }
 }
 
 
@@ -181,7 +401,10 @@ float tld::utils::IoU(const BBox& bbox1, const BBox& bbox2)
 
 /**
  * Non-maximal suppression.
- * Clusters neighboring bboxes and and for each clusters computes the average bbox.
+ * Clusters neighboring bboxes (connected components of the bboxes with IoU >= overlapThreshold)
+ * and for each cluster computes the average bbox. The clusters are ordered by their first bbox.
+ * The bboxes are binned into a grid of cells at least as large as the largest bbox, so that only
+ * the bboxes in the same and in the adjacent cells are compared, and merged with a union-find.
  */
 std::vector<BBox> tld::utils::NMS(const std::vector<BBox> &bboxSet,
                                             float overlapThreshold)
@@ -191,70 +414,118 @@ std::vector<BBox> tld::utils::NMS(const std::vector<BBox> &bboxSet,
         return std::vector<BBox>();
     }
 
-    // Calculate pairwise overlaps between all the bboxes in the bboxSet and create adjecency list
-    int N = bboxSet.size();
-    std::vector<std::vector<int>> adjacencyList(N);
-    for (int i = 0; i < N; ++i)
+    const int N = bboxSet.size();
+
+    // Union-find forest, the root of a tree is its smallest index
+    std::vector<int> parent(N);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto findRoot = [&parent](int i)
     {
-        for (int j = 0; j < N; ++j)
+        while (parent[i] != i)
         {
-            float iou = tld::utils::IoU(bboxSet[i], bboxSet[j]);
-            if (iou >= overlapThreshold)
-            {
-                adjacencyList[i].push_back(j);
-            }
+            parent[i] = parent[parent[i]];  // path halving
+            i = parent[i];
         }
+        return i;
+    };
+
+    // Bin the bboxes by their top-left corners. Two bboxes with a positive IoU intersect,
+    // so their corners lie in the same or in adjacent cells. Without a positive threshold
+    // any two bboxes may be merged, so a single cell is used.
+    float minX = bboxSet[0].x, minY = bboxSet[0].y;
+    float maxX = minX, maxY = minY;
+    float cellSize = 0.0f;
+    for (const BBox& bbox : bboxSet)
+    {
+        minX = std::min(minX, bbox.x);
+        minY = std::min(minY, bbox.y);
+        maxX = std::max(maxX, bbox.x);
+        maxY = std::max(maxY, bbox.y);
+        cellSize = std::max(cellSize, std::max(bbox.width, bbox.height));
+    }
+    int numCols = 1;
+    int numRows = 1;
+    if (overlapThreshold > 0.0f && cellSize > 0.0f)
+    {
+        numCols = static_cast<int>((maxX - minX) / cellSize) + 1;
+        numRows = static_cast<int>((maxY - minY) / cellSize) + 1;
     }
+    auto cellCol = [&](const BBox& bbox) { return std::min(static_cast<int>((bbox.x - minX) / cellSize), numCols - 1); };
+    auto cellRow = [&](const BBox& bbox) { return std::min(static_cast<int>((bbox.y - minY) / cellSize), numRows - 1); };
 
-    // Cluster the adjacent bboxes using BFS
-    std::vector<std::vector<int>> clusters;
-    int clusterIndex = 0;
-    std::queue<int> queue;
-    std::set<int> seenIndices;
+    // Counting sort of the bbox indices by cell, the bboxes of cell c are cellItems[cellStart[c], cellStart[c + 1])
+    std::vector<int> cellOf(N);
+    std::vector<int> cellStart(numCols * numRows + 1, 0);
     for (int i = 0; i < N; ++i)
     {
-        std::vector<int> bboxIndices;
-        if (seenIndices.empty() || seenIndices.find(i) == seenIndices.end())
+        cellOf[i] = (numCols > 1 || numRows > 1) ? cellRow(bboxSet[i]) * numCols + cellCol(bboxSet[i]) : 0;
+        cellStart[cellOf[i] + 1]++;
+    }
+    std::partial_sum(cellStart.begin(), cellStart.end(), cellStart.begin());
+    std::vector<int> cellItems(N);
+    std::vector<int> cellFill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < N; ++i)
+    {
+        cellItems[cellFill[cellOf[i]]++] = i;
+    }
+
+    // Merge the overlapping bboxes of the neighboring cells
+    for (int i = 0; i < N; ++i)
+    {
+        const int col = cellOf[i] % numCols;
+        const int row = cellOf[i] / numCols;
+        for (int r = std::max(row - 1, 0); r <= std::min(row + 1, numRows - 1); ++r)
         {
-            seenIndices.insert(i);
-            bboxIndices.push_back(i);
-            queue.push(i);
-            while(!queue.empty())
+            for (int c = std::max(col - 1, 0); c <= std::min(col + 1, numCols - 1); ++c)
             {
-                int ii = queue.front();
-                queue.pop();
-                for (const int& idj : adjacencyList[ii])
+                const int cell = r * numCols + c;
+                for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k)
                 {
-                    if (seenIndices.find(idj) == seenIndices.end())
+                    const int j = cellItems[k];
+                    if (j <= i || tld::utils::IoU(bboxSet[i], bboxSet[j]) < overlapThreshold)
                     {
-                        seenIndices.insert(idj);
-                        bboxIndices.push_back(idj);
-                        queue.push(idj);
+                        continue;
+                    }
+                    const int rootI = findRoot(i);
+                    const int rootJ = findRoot(j);
+                    if (rootI != rootJ)
+                    {
+                        parent[std::max(rootI, rootJ)] = std::min(rootI, rootJ);
                     }
                 }
             }
-            clusters.push_back(bboxIndices);
-            clusterIndex++;
         }
     }
 
-    // Compute the average bbox for each cluster
-    std::vector<BBox> avgBboxes;
-    for (const auto& cluster : clusters)
+    // Compute the average bbox for each cluster. A root is the first bbox of its cluster,
+    // so the clusters are numbered in the order of their first bboxes.
+    std::vector<int> clusterOf(N, -1);
+    std::vector<BBox> sums;  // sums of the coordinates of the bboxes of each cluster
+    std::vector<int> clusterSizes;
+    for (int i = 0; i < N; ++i)
     {
-        int clusterSize = cluster.size();
-        float x = 0.0f, y = 0.0f;
-        float w = 0.0f, h = 0.0f;
-        for (const int& i : cluster)
+        const int root = findRoot(i);
+        if (clusterOf[root] < 0)
         {
-            BBox bbox = bboxSet[i];
-            x += bbox.x;
-            y += bbox.y;
-            w += bbox.width;
-            h += bbox.height;
+            clusterOf[root] = static_cast<int>(sums.size());
+            sums.push_back(BBox(0.0f, 0.0f, 0.0f, 0.0f));
+            clusterSizes.push_back(0);
         }
-        BBox avgBbox(x / clusterSize, y / clusterSize, w / clusterSize, h / clusterSize);
-        avgBboxes.push_back(avgBbox);
+        const int cluster = clusterOf[root];
+        const BBox& bbox = bboxSet[i];
+        sums[cluster].x += bbox.x;
+        sums[cluster].y += bbox.y;
+        sums[cluster].width += bbox.width;
+        sums[cluster].height += bbox.height;
+        clusterSizes[cluster]++;
+    }
+
+    std::vector<BBox> avgBboxes;
+    for (std::size_t c = 0; c < sums.size(); ++c)
+    {
+        const float clusterSize = static_cast<float>(clusterSizes[c]);
+        avgBboxes.push_back(BBox(sums[c].x / clusterSize, sums[c].y / clusterSize,
+                                 sums[c].width / clusterSize, sums[c].height / clusterSize));
     }
 
     return avgBboxes;
@@ -263,54 +534,70 @@ std::vector<BBox> tld::utils::NMS(const std::vector<BBox> &bboxSet,
 
 /**
  * Computes the integral image of both the input image and its squares
- * and stores them to iImage and iImageSq respectively.
+ * and stores them to integral.sum and integral.sqSum respectively.
  */
-void tld::utils::computeIntegralImage2(const cv::Mat& image, cv::Mat& iImage, cv::Mat& iImageSq)
+void tld::utils::computeIntegralImage2(const cv::Mat& image, IntegralImage& integral)
 {
     CV_Assert(image.type() == CV_8UC1);
 
     const int nRows = image.rows;
     const int nCols = image.cols;
+    const int step = nCols + 1;
 
-    CV_Assert(255.0 * nRows * nCols < std::numeric_limits<int>::max());
-    CV_Assert(255.0 * 255.0 * nRows * nCols < std::numeric_limits<float>::max());
+    integral.rows = nRows + 1;
+    integral.cols = nCols + 1;
+    integral.origin = cv::Point(0, 0);
+    integral.sum.assign(integral.rows * integral.cols, 0);
+    integral.sqSum.assign(integral.rows * integral.cols, 0);
 
-    iImage = cv::Mat::zeros(nRows + 1, nCols + 1, CV_32SC1);
-    iImageSq = cv::Mat::zeros(nRows + 1, nCols + 1, CV_32FC1);
-    
     for (int i = 1; i <= nRows; ++i)
     {
-        // Get the pointer to the ith and (i-1)th rows of the iImage
-        int* const iImageRowPtr = iImage.ptr<int>(i);
-        const int* const iImagePrevRowPtr = iImage.ptr<int>(i - 1);
-        // Get the pointer to the ith and (i-1)th rows of the iImageSq
-        float* const iImageSqRowPtr = iImageSq.ptr<float>(i);
-        const float* const iImageSqPrevRowPtr = iImageSq.ptr<float>(i - 1);
+        // Get the pointer to the ith and (i-1)th rows of the integral images
+        std::int64_t* const sumRowPtr = &integral.sum[i * step];
+        const std::int64_t* const sumPrevRowPtr = &integral.sum[(i - 1) * step];
+        std::int64_t* const sqSumRowPtr = &integral.sqSum[i * step];
+        const std::int64_t* const sqSumPrevRowPtr = &integral.sqSum[(i - 1) * step];
         // Get the pointer to the (i-1)th rows of the image
         const uchar* const imagePrevRowPtr = image.ptr<uchar>(i - 1);
-        // Compute the integral image and the integral image of squares
+        // Accumulate the row sums and add the integral of the previous row
+        std::int64_t rowSum = 0;
+        std::int64_t rowSqSum = 0;
         for (int j = 1; j <= nCols; ++j)
         {
-            int imgVal = static_cast<int>(imagePrevRowPtr[j - 1]);
-            iImageRowPtr[j] = iImageRowPtr[j - 1] + iImagePrevRowPtr[j] - iImagePrevRowPtr[j - 1] + imgVal;
-            iImageSqRowPtr[j] = iImageSqRowPtr[j - 1] + iImageSqPrevRowPtr[j] - iImageSqPrevRowPtr[j - 1] + 1.0f * imgVal * imgVal;
+            const std::int64_t imgVal = imagePrevRowPtr[j - 1];
+            rowSum += imgVal;
+            rowSqSum += imgVal * imgVal;
+            sumRowPtr[j] = sumPrevRowPtr[j] + rowSum;
+            sqSumRowPtr[j] = sqSumPrevRowPtr[j] + rowSqSum;
         }
     }
 }
 
 
 /**
- * Sum the pixels of an image patch defined by the given bbox using the integral image iImage.
+ * Computes the integral images of the given region of the input image only.
+ * The entry (0, 0) of the integral images corresponds to integral.origin = region.tl().
  */
-float tld::utils::sumPatch(const cv::Mat& iImage, const BBox& bbox)
+void tld::utils::computeIntegralImage2(const cv::Mat& image, const cv::Rect& region, IntegralImage& integral)
 {
-    float x = bbox.x, y = bbox.y, width = bbox.width, height = bbox.height;
-    CV_Assert(x >= 0 && (x + width) <= iImage.cols && y >= 0 && (y + height) <= iImage.rows);
+    tld::utils::computeIntegralImage2(image(region), integral);
+    integral.origin = region.tl();
+}
+
+
+/**
+ * Sum the pixels of an image patch defined by the given rect using the integral image
+ * (one of the images of IntegralImage, whose rows have integralCols entries).
+ */
+std::int64_t tld::utils::sumPatch(const std::vector<std::int64_t>& integralImage, int integralCols, const cv::Rect& rect)
+{
+    const int integralRows = static_cast<int>(integralImage.size()) / integralCols;
+    CV_Assert(rect.x >= 0 && (rect.x + rect.width) < integralCols && rect.y >= 0 && (rect.y + rect.height) < integralRows);
 
-    float A = iImage.at<float>(y, x);  //at(row, col)
-    float B = iImage.at<float>(y, x + width);
-    float C = iImage.at<float>(y + height, x);
-    float D = iImage.at<float>(y + height, x + width);
+    std::int64_t A = integralImage[rect.y * integralCols + rect.x];
+    std::int64_t B = integralImage[rect.y * integralCols + rect.x + rect.width];
+    std::int64_t C = integralImage[(rect.y + rect.height) * integralCols + rect.x];
+    std::int64_t D = integralImage[(rect.y + rect.height) * integralCols + rect.x + rect.width];
 
     return D + A - B - C;
 }
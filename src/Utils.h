@@ -3,6 +3,7 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <random>
+#include <cstdint>
 
 
 using BBox = cv::Rect2f;
@@ -16,6 +17,10 @@ namespace tld
 		private:
 			std::mt19937 engine;
 
+			// Reused by every call (the parameters are passed per call)
+			std::uniform_real_distribution<float> uniformReal;
+			std::uniform_int_distribution<int> uniformInt;
+
 		public:
 			unsigned int seed;
 			Random() = default;
@@ -25,20 +30,56 @@ namespace tld
 			float randN(float low, float high);
 		};
 
+		// Integral images of an image and of its squares with 64-bit integer entries.
+		// Both are of size (rows + 1) x (cols + 1) of the image and stored row by row.
+		// If only a region of a frame is integrated, origin is the top-left corner of the region.
+		struct IntegralImage
+		{
+			int rows = 0;
+			int cols = 0;
+			cv::Point origin;
+			std::vector<std::int64_t> sum;
+			std::vector<std::int64_t> sqSum;
+		};
+
 		float round(float x, unsigned int n);
 
 		float median(std::vector<float> values);
 
-		void computeIntegralImage2(const cv::Mat &img, cv::Mat &iImage, cv::Mat &iImageSq);
+		float median(float *values, std::size_t n);  // reorders the values
+
+		// Median of the ratios of the pairwise distances of points2 and of the corresponding points1 (1 if there is no pair).
+		// With rankTolerance > 0 and an rng the ratios of scaleSampleBudget random pairs are used instead of all the pairs.
+		float medianScaleChange(const std::vector<cv::Point2f> &points1,
+		                        const std::vector<cv::Point2f> &points2,
+		                        float rankTolerance = 0.0f,
+		                        Random *rng = nullptr);
+
+		int scaleSampleBudget(float rankTolerance);
+
+		void computeIntegralImage2(const cv::Mat &img, IntegralImage &integral);
+
+		void computeIntegralImage2(const cv::Mat &img, const cv::Rect &region, IntegralImage &integral);
 
 		bool bboxWithinImage(const BBox &bbox, const cv::Mat &image);
 
-		float sumPatch(const cv::Mat &integralImage, const BBox &bbox);
+		std::int64_t sumPatch(const std::vector<std::int64_t> &integralImage, int integralCols, const cv::Rect &rect);
 
 		cv::Mat getPatch(const cv::Mat &image, cv::Point2f patchCenter, cv::Size patchSize);
 
 		float computeNCC(const cv::Mat &patch1, const cv::Mat &patch2);
 
+		// computeNCC of the patchSize patches of image1 around points1[i] and of image2 around points2[i]
+		// for every i < numPoints with mask[i] != 0, written consecutively to ncc. Returns the number of values.
+		int computeNCCBatch(const cv::Mat &image1, const cv::Point2f *points1,
+		                    const cv::Mat &image2, const cv::Point2f *points2,
+		                    const unsigned char *mask, int numPoints,
+		                    cv::Size patchSize, float *ncc);
+
+		void normalizePatch(const cv::Mat &patch, float *vector);
+
+		void approxGaussianBlur(const cv::Mat &image, cv::Mat &blurred, float sigma);
+
 		float IoU(const BBox &bbox1, const BBox &bbox2); // Intersection over Union
 
 		std::vector<BBox> NMS(const std::vector<BBox> &bboxSet, float overlapThreshold); // Non-Maximal Suppression
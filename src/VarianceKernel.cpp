@@ -0,0 +1,126 @@
+#include <limits>
+#include "FernKernel.h"  // tld::kernels::hasAVX2
+#include "VarianceKernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TLD_AVX2_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Portable kernel.
+ */
+void tld::kernels::varianceFilterScalar(const std::int64_t* sum, const std::int64_t* sqSum,
+                                        int count, int stride,
+                                        int cornerB, int cornerC, int cornerD,
+                                        std::int64_t area, std::int64_t threshold,
+                                        std::uint64_t* mask, std::size_t bitOffset)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const std::int64_t* s = sum + i * stride;
+        const std::int64_t* s2 = sqSum + i * stride;
+        const std::int64_t S = s[cornerD] + s[0] - s[cornerB] - s[cornerC];
+        const std::int64_t S2 = s2[cornerD] + s2[0] - s2[cornerB] - s2[cornerC];
+        if (area * S2 - S * S > threshold)
+        {
+            const std::size_t bit = bitOffset + i;
+            mask[bit >> 6] |= std::uint64_t(1) << (bit & 63);
+        }
+    }
+}
+
+
+#ifdef TLD_AVX2_DISPATCH
+
+/**
+ * AVX2 kernel, evaluates 4 windows at once with 64-bit gathers.
+ * The sum of a window has to fit into 31 bits (area * 255 < 2^31), otherwise the scalar kernel is used.
+ */
+__attribute__((target("avx2")))
+void tld::kernels::varianceFilterAVX2(const std::int64_t* sum, const std::int64_t* sqSum,
+                                      int count, int stride,
+                                      int cornerB, int cornerC, int cornerD,
+                                      std::int64_t area, std::int64_t threshold,
+                                      std::uint64_t* mask, std::size_t bitOffset)
+{
+    int i = 0;
+    if (area * 255 < std::numeric_limits<std::int32_t>::max())
+    {
+        const __m256i indices = _mm256_set_epi64x(3LL * stride, 2LL * stride, stride, 0);
+        const __m256i offsetB = _mm256_add_epi64(indices, _mm256_set1_epi64x(cornerB));
+        const __m256i offsetC = _mm256_add_epi64(indices, _mm256_set1_epi64x(cornerC));
+        const __m256i offsetD = _mm256_add_epi64(indices, _mm256_set1_epi64x(cornerD));
+        const __m256i vArea = _mm256_set1_epi64x(area);
+        const __m256i vThreshold = _mm256_set1_epi64x(threshold);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const long long* s = reinterpret_cast<const long long*>(sum + i * stride);
+            const long long* s2 = reinterpret_cast<const long long*>(sqSum + i * stride);
+
+            __m256i S = _mm256_sub_epi64(_mm256_add_epi64(_mm256_i64gather_epi64(s, offsetD, 8),
+                                                          _mm256_i64gather_epi64(s, indices, 8)),
+                                         _mm256_add_epi64(_mm256_i64gather_epi64(s, offsetB, 8),
+                                                          _mm256_i64gather_epi64(s, offsetC, 8)));
+            __m256i S2 = _mm256_sub_epi64(_mm256_add_epi64(_mm256_i64gather_epi64(s2, offsetD, 8),
+                                                           _mm256_i64gather_epi64(s2, indices, 8)),
+                                          _mm256_add_epi64(_mm256_i64gather_epi64(s2, offsetB, 8),
+                                                           _mm256_i64gather_epi64(s2, offsetC, 8)));
+
+            // area * S2 from the 32-bit halves of S2 (area fits into 32 bits), S * S from the lower 32 bits of S
+            __m256i areaS2 = _mm256_add_epi64(_mm256_mul_epu32(vArea, S2),
+                                              _mm256_slli_epi64(_mm256_mul_epu32(vArea, _mm256_srli_epi64(S2, 32)), 32));
+            __m256i SS = _mm256_mul_epi32(S, S);
+            __m256i passed = _mm256_cmpgt_epi64(_mm256_sub_epi64(areaS2, SS), vThreshold);
+
+            int bits = _mm256_movemask_pd(_mm256_castsi256_pd(passed));
+            for (int l = 0; l < 4; ++l)
+            {
+                if (bits & (1 << l))
+                {
+                    const std::size_t bit = bitOffset + i + l;
+                    mask[bit >> 6] |= std::uint64_t(1) << (bit & 63);
+                }
+            }
+        }
+    }
+
+    tld::kernels::varianceFilterScalar(sum + i * stride, sqSum + i * stride, count - i, stride,
+                                       cornerB, cornerC, cornerD, area, threshold,
+                                       mask, bitOffset + i);
+}
+
+#else
+
+void tld::kernels::varianceFilterAVX2(const std::int64_t* sum, const std::int64_t* sqSum,
+                                      int count, int stride,
+                                      int cornerB, int cornerC, int cornerD,
+                                      std::int64_t area, std::int64_t threshold,
+                                      std::uint64_t* mask, std::size_t bitOffset)
+{
+    tld::kernels::varianceFilterScalar(sum, sqSum, count, stride, cornerB, cornerC, cornerD,
+                                       area, threshold, mask, bitOffset);
+}
+
+#endif
+
+
+void tld::kernels::varianceFilter(const std::int64_t* sum, const std::int64_t* sqSum,
+                                  int count, int stride,
+                                  int cornerB, int cornerC, int cornerD,
+                                  std::int64_t area, std::int64_t threshold,
+                                  std::uint64_t* mask, std::size_t bitOffset)
+{
+    if (tld::kernels::hasAVX2())
+    {
+        tld::kernels::varianceFilterAVX2(sum, sqSum, count, stride, cornerB, cornerC, cornerD,
+                                         area, threshold, mask, bitOffset);
+    }
+    else
+    {
+        tld::kernels::varianceFilterScalar(sum, sqSum, count, stride, cornerB, cornerC, cornerD,
+                                           area, threshold, mask, bitOffset);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace tld
+{
+	namespace kernels
+	{
+		// All the kernels evaluate the variance filter for count windows of the same scale lying on
+		// one row of the grid. The top-left corner of window i is at sum[i * stride] (and sqSum[i * stride])
+		// of the 64-bit integral images, and cornerB/C/D are the offsets of its other corners.
+		// A window of area pixels passes the filter if area * sumOfSquares - sum^2 > threshold,
+		// i.e. if its variance is larger than threshold / area^2. For every window that passes,
+		// bit (bitOffset + i) of mask is set.
+
+		void varianceFilterScalar(const std::int64_t* sum, const std::int64_t* sqSum,
+								  int count, int stride,
+								  int cornerB, int cornerC, int cornerD,
+								  std::int64_t area, std::int64_t threshold,
+								  std::uint64_t* mask, std::size_t bitOffset);
+
+		void varianceFilterAVX2(const std::int64_t* sum, const std::int64_t* sqSum,
+								int count, int stride,
+								int cornerB, int cornerC, int cornerD,
+								std::int64_t area, std::int64_t threshold,
+								std::uint64_t* mask, std::size_t bitOffset);
+
+		// Dispatches to the fastest kernel supported by the CPU.
+		void varianceFilter(const std::int64_t* sum, const std::int64_t* sqSum,
+							int count, int stride,
+							int cornerB, int cornerC, int cornerD,
+							std::int64_t area, std::int64_t threshold,
+							std::uint64_t* mask, std::size_t bitOffset);
+
+	} // namespace kernels
+} // namespace tld